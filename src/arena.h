@@ -0,0 +1,57 @@
+#ifndef P_ARENA_H
+#define P_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+namespace p {
+    // Bump allocator for trivially copyable objects that refer to each other by dense 32-bit
+    // index. Objects are allocated in chunks that double in size, starting at 2^FirstBits
+    // objects, so small arenas stay small and big ones take few allocations. Objects never move,
+    // everything is released at once when the arena is destroyed.
+    template<class T, size_t FirstBits = 6>
+    class Arena {
+    public:
+        static const size_t first_chunk_size = size_t(1) << FirstBits;
+
+        Arena() : count(0), capacity(0) { }
+
+        // Appends value and returns its index.
+        uint32_t push(const T& value) {
+            if (count == capacity) {
+                size_t size = first_chunk_size << chunks.size();
+                chunks.emplace_back(new T[size]);
+                capacity += size;
+            }
+
+            (*this)[count] = value;
+            return count++;
+        }
+
+        T& operator[](uint32_t i) { return locate(chunks, i); }
+        const T& operator[](uint32_t i) const { return locate(chunks, i); }
+
+        uint32_t size() const { return count; }
+        size_t bytes() const { return capacity * sizeof(T); }
+
+    private:
+        // Chunk k starts at index (2^k - 1) * first_chunk_size, so the highest bit of
+        // i + first_chunk_size is bit FirstBits + k, and the bits below it are the offset of i
+        // in its chunk.
+        template<class Chunks>
+        static T& locate(Chunks& chunks, uint32_t i) {
+            uint64_t n = uint64_t(i) + first_chunk_size;
+            unsigned high = 63 - __builtin_clzll(n);
+            return chunks[high - FirstBits][n - (uint64_t(1) << high)];
+        }
+
+        std::vector<std::unique_ptr<T[]>> chunks;
+        uint32_t count;
+        size_t capacity; // Objects that fit in the chunks.
+    };
+}
+
+#endif
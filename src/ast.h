@@ -1,18 +1,47 @@
 #ifndef P_AST_H
 #define P_AST_H
 
+#include "arena.h"
+#include "lexer.h"
+
 namespace p {
     struct AST {
-        enum Type {
-            block,
-            expression,
+        enum Type : uint8_t {
+            block,      // Statements between braces, or the whole file for the root.
+            expression, // A statement, a sequence of expressions ending at a newline.
+            group,      // Expressions between parentheses or square brackets.
+            atom,       // A single token.
+            unary,      // A prefix operator, the token, and its operand.
+            binary,     // A binary operator, the token, and its left and right operands.
+            call,       // An expression and the parenthesized group directly after it.
+            index,      // An expression and the square bracketed group directly after it.
+            member,     // An expression, a period (the token) and the identifier after it.
+            unparsed    // A block left unparsed by parse_lazy, without children until it is
+                        // expanded. first_child is the index of its opening brace in the
+                        // tokens, and the symbol of its token how deep it is nested.
+        };
+
+        Type type;
+        uint32_t first_child; // Index of the first child in Tree::children.
+        uint32_t num_children;
+        Token token;          // The first token of the node, eof for the root.
+        size_t begin;         // Byte range in the source spanned by the node.
+        size_t end;
+    };
+
+
+    // The syntax tree of a compilation unit. Nodes live in an arena and refer to each other by
+    // index, the children of each node are a contiguous range in a second arena.
+    struct Tree {
+        const AST& child(const AST& node, uint32_t i) const {
+            return nodes[children[node.first_child + i]];
         }
 
-        std::string value;
-        std::vector<std::shared_ptr<AST>> children;
+        Arena<AST> nodes;
+        Arena<uint32_t> children;
+        uint32_t root;
+        uint32_t unused = 0; // Nodes that reparse replaced, which the tree no longer refers to.
     };
 }
 
 #endif
-
-
@@ -0,0 +1,315 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+#include "decode.h"
+#include "exception.h"
+#include "intern.h"
+#include "lexer.h"
+#include "parse.h"
+#include "source.h"
+#include "stats.h"
+
+
+// Hardware counters of the calling thread in user space, read through perf_event_open. If the
+// kernel doesn't allow it (e.g. in containers or with a high perf_event_paranoid) the counters
+// are simply unavailable.
+class PerfCounters {
+public:
+    enum { cycles, instructions, branch_misses, num_counters };
+
+    PerfCounters() {
+        for (int& fd : fds) fd = -1;
+
+#ifdef __linux__
+        const uint64_t configs[num_counters] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        for (int i = 0; i < num_counters; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i ? fds[0] : -1, 0);
+            if (fds[i] < 0) {
+                close_all();
+                return;
+            }
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    ~PerfCounters() { close_all(); }
+
+    bool available() const { return fds[0] >= 0; }
+
+    void start() {
+#ifdef __linux__
+        if (!available()) return;
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    // Stops counting and stores the counts since start() in values.
+    void stop(uint64_t values[num_counters]) {
+        for (int i = 0; i < num_counters; ++i) values[i] = 0;
+
+#ifdef __linux__
+        if (!available()) return;
+        ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        uint64_t group[1 + num_counters];
+        if (read(fds[0], group, sizeof(group)) != ssize_t(sizeof(group))) return;
+        for (int i = 0; i < num_counters; ++i) values[i] = group[1 + i];
+#endif
+    }
+
+private:
+    void close_all() {
+#ifdef __linux__
+        for (int& fd : fds) {
+            if (fd >= 0) close(fd);
+            fd = -1;
+        }
+#endif
+    }
+
+    int fds[num_counters];
+};
+
+
+struct Phase {
+    const char* name;
+    double seconds;                                    // Of the fastest iteration.
+    size_t allocations;
+    uint64_t counters[PerfCounters::num_counters];
+};
+
+
+// Runs prepare and then run iterations times, timing only run, and returns the measurements of
+// the fastest iteration.
+template<class Prepare, class Run>
+static Phase measure(const char* name, size_t iterations, PerfCounters& perf,
+                     Prepare prepare, Run run) {
+    Phase best = {name, 0, 0, {}};
+    for (size_t i = 0; i < iterations; ++i) {
+        prepare();
+
+        Phase phase = {name, 0, 0, {}};
+        size_t allocations = p::allocation_count();
+        perf.start();
+        auto start = std::chrono::steady_clock::now();
+
+        run();
+
+        auto stop = std::chrono::steady_clock::now();
+        perf.stop(phase.counters);
+        phase.allocations = p::allocation_count() - allocations;
+        phase.seconds = std::chrono::duration<double>(stop - start).count();
+
+        if (i == 0 || phase.seconds < best.seconds) best = phase;
+    }
+
+    return best;
+}
+
+
+// Where touch_pages leaves the bytes it read, so they can't be optimized away.
+static volatile uint8_t touched;
+
+// Reads a byte of every page of source. Mapped files are only read from disk or the page cache
+// when their pages are first touched, which belongs to reading them rather than to whatever
+// happens to look at them first.
+static void touch_pages(const p::SourceBuffer& source) {
+    const size_t page_size = 4096;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < source.size(); i += page_size) sum += source.data()[i];
+    touched = sum;
+}
+
+
+static void print_text(const std::vector<Phase>& phases, size_t num_files, size_t bytes,
+                       size_t tokens, size_t iterations, bool have_counters) {
+    std::printf("%zu files, %zu bytes, %zu tokens, best of %zu iterations\n\n",
+                num_files, bytes, tokens, iterations);
+    std::printf("%-8s %10s %10s %10s %9s %12s %11s %11s %11s\n", "phase", "time (ms)", "MB/s",
+                "Mtokens/s", "ns/token", "allocs/token", "cycles/tok", "instrs/tok",
+                "bmiss/tok");
+
+    for (auto& phase : phases) {
+        std::printf("%-8s %10.3f %10.1f %10.2f %9.2f %12.3f", phase.name, phase.seconds * 1e3,
+                    bytes / phase.seconds / 1e6, tokens / phase.seconds / 1e6,
+                    phase.seconds * 1e9 / tokens, double(phase.allocations) / tokens);
+
+        for (uint64_t count : phase.counters) {
+            if (have_counters) std::printf(" %11.2f", double(count) / tokens);
+            else std::printf(" %11s", "n/a");
+        }
+
+        std::printf("\n");
+    }
+}
+
+
+static void print_json(const std::vector<Phase>& phases, size_t num_files, size_t bytes,
+                       size_t tokens, size_t iterations, bool have_counters) {
+    const char* counter_names[] = {"cycles", "instructions", "branch_misses"};
+
+    std::printf("{\n  \"files\": %zu,\n  \"bytes\": %zu,\n  \"tokens\": %zu,\n"
+                "  \"iterations\": %zu,\n  \"phases\": [\n", num_files, bytes, tokens,
+                iterations);
+
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const Phase& phase = phases[i];
+        std::printf("    {\"name\": \"%s\", \"seconds\": %.9f, \"mb_per_s\": %.3f, "
+                    "\"tokens_per_s\": %.1f, \"ns_per_token\": %.4f, "
+                    "\"allocations\": %zu, \"allocs_per_token\": %.6f",
+                    phase.name, phase.seconds, bytes / phase.seconds / 1e6,
+                    tokens / phase.seconds, phase.seconds * 1e9 / tokens, phase.allocations,
+                    double(phase.allocations) / tokens);
+
+        for (int c = 0; c < PerfCounters::num_counters; ++c) {
+            if (have_counters) {
+                std::printf(", \"%s\": %llu", counter_names[c],
+                            (unsigned long long) phase.counters[c]);
+            } else {
+                std::printf(", \"%s\": null", counter_names[c]);
+            }
+        }
+
+        std::printf("}%s\n", i + 1 < phases.size() ? "," : "");
+    }
+
+    std::printf("  ]\n}\n");
+}
+
+
+int main(int argc, char** argv) {
+    std::vector<const char*> files;
+    size_t iterations = 10;
+    bool json = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (std::strncmp(argv[i], "--iterations=", 13) == 0) {
+            iterations = std::strtoull(argv[i] + 13, nullptr, 10);
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    if (files.empty()) files.push_back("test.p");
+    if (!iterations) {
+        std::fprintf(stdout, "Usage: %s [--json] [--iterations=<n>] [<file>...]\n", argv[0]);
+        return 1;
+    }
+
+    // Decoded copies of the corpus, which the lexing and compiling phases run on. Files with
+    // syntax errors are fine, that measures error recovery.
+    std::vector<p::SourceBuffer> sources;
+    size_t bytes = 0, tokens = 0;
+    for (const char* file : files) {
+        try {
+            sources.push_back(p::read_source(file));
+        } catch (const p::FilesystemError& e) {
+            std::fprintf(stderr, "error: %s: %s\n", file, e.what());
+            return 1;
+        }
+
+        p::Diagnostics diagnostics;
+        if (!p::decode_source(sources.back(), diagnostics)) {
+            std::fprintf(stderr, "%s:%zu: %s\n", file, diagnostics[0].offset,
+                         diagnostics[0].message.c_str());
+            return 1;
+        }
+
+        bytes += sources.back().size();
+
+        p::Interner symbols;
+        p::Lexer lexer(sources.back().begin(), sources.back().end(), symbols, diagnostics);
+        while (lexer.consume().type != p::Token::Type::eof) ++tokens;
+        p::compile(sources.back().begin(), sources.back().end(), symbols, diagnostics);
+
+        if (!diagnostics.empty()) {
+            std::fprintf(stderr, "note: %s has %zu errors\n", file, diagnostics.size());
+        }
+    }
+
+    // Avoid dividing by zero for empty inputs.
+    if (!tokens) tokens = 1;
+
+    PerfCounters perf;
+    std::vector<Phase> phases;
+    auto nothing = [] { };
+
+    phases.push_back(measure("read", iterations, perf, nothing, [&] {
+        for (const char* file : files) touch_pages(p::read_source(file));
+    }));
+
+    // Decoding may replace the buffer, so every iteration starts from freshly read files.
+    std::vector<p::SourceBuffer> raw;
+    p::Diagnostics diagnostics;
+    phases.push_back(measure("decode", iterations, perf, [&] {
+        raw.clear();
+        for (const char* file : files) {
+            raw.push_back(p::read_source(file));
+            touch_pages(raw.back());
+        }
+    }, [&] {
+        for (auto& source : raw) p::decode_source(source, diagnostics);
+    }));
+    raw.clear();
+
+    phases.push_back(measure("lex", iterations, perf, nothing, [&] {
+        for (auto& source : sources) {
+            p::Interner symbols;
+            p::Diagnostics diagnostics;
+            p::Lexer lexer(source.begin(), source.end(), symbols, diagnostics);
+            while (lexer.consume().type != p::Token::Type::eof) { }
+        }
+    }));
+
+    phases.push_back(measure("compile", iterations, perf, nothing, [&] {
+        for (auto& source : sources) {
+            p::Interner symbols;
+            p::Diagnostics diagnostics;
+            p::compile(source.begin(), source.end(), symbols, diagnostics);
+        }
+    }));
+
+    // What an outline of each file takes: its tokens, and a tree without the insides of blocks.
+    phases.push_back(measure("lazy", iterations, perf, nothing, [&] {
+        for (auto& source : sources) {
+            p::Interner symbols;
+            p::Diagnostics diagnostics;
+            std::vector<p::Token> tokens = p::lex_all(source.begin(), source.end(), symbols,
+                                                      diagnostics);
+            p::parse_lazy(tokens, diagnostics);
+        }
+    }));
+
+    if (json) print_json(phases, files.size(), bytes, tokens, iterations, perf.available());
+    else print_text(phases, files.size(), bytes, tokens, iterations, perf.available());
+
+    return 0;
+}
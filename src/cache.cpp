@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "exception.h"
+#include "hash.h"
+
+
+namespace p {
+    static const char* const entry_suffix = ".entry";
+    static const char* const temp_infix = ".tmp.";
+
+    // Temporary files older than this are left over from writers that were killed.
+    static const time_t stale_temp_seconds = 60 * 60;
+
+    // Version of the compiler, a hash of the sources it was built from that the Makefile passes
+    // in, so results cached by a build from other sources are never reused.
+#ifndef P_SOURCE_HASH
+    #error "P_SOURCE_HASH must be defined to a string identifying the sources"
+#endif
+    static const char* const compiler_version = P_SOURCE_HASH;
+
+
+    // Creates path and its parents, like mkdir -p.
+    static bool make_directories(const std::string& path) {
+        for (size_t i = 1; i <= path.size(); ++i) {
+            if (i < path.size() && path[i] != '/') continue;
+            if (mkdir(path.substr(0, i).c_str(), 0755) != 0 && errno != EEXIST) return false;
+        }
+
+        return true;
+    }
+
+
+    Cache::Cache(std::string directory, size_t max_size)
+    : directory(std::move(directory)), max_size(max_size), stored(false) { }
+
+    std::string Cache::default_directory() {
+        if (const char* dir = std::getenv("P_CACHE_DIR")) {
+            if (*dir) return dir;
+        }
+
+        if (const char* dir = std::getenv("XDG_CACHE_HOME")) {
+            if (*dir) return std::string(dir) + "/p";
+        }
+
+        const char* home = std::getenv("HOME");
+        return std::string(home && *home ? home : ".") + "/.cache/p";
+    }
+
+    uint64_t Cache::key(const uint8_t* data, size_t size, size_t max_depth) {
+        static const uint64_t seed = hash64(reinterpret_cast<const uint8_t*>(compiler_version),
+                                            std::strlen(compiler_version), unit_format_version);
+        uint64_t depth = max_depth;
+        return hash64(data, size, hash64(reinterpret_cast<const uint8_t*>(&depth), sizeof(depth),
+                                         seed));
+    }
+
+    std::string Cache::path(uint64_t key) const {
+        char name[17];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+        return directory + "/" + name + entry_suffix;
+    }
+
+
+    CacheEntry Cache::load(uint64_t key, size_t source_size) {
+        CacheEntry entry;
+        std::string entry_path = path(key);
+        try {
+            entry.file = read_source(entry_path.c_str());
+        } catch (const FilesystemError&) {
+            return entry;
+        }
+
+        // Keys can collide in theory, the size makes that even less likely to go unnoticed.
+        if (!entry.view.open(entry.file.data(), entry.file.size()) ||
+            entry.view.source_hash() != key || entry.view.source_size() != source_size) {
+            entry.view = UnitView();
+            return entry;
+        }
+
+        // Entries are evicted by modification time, so this marks it as recently used.
+        utimensat(AT_FDCWD, entry_path.c_str(), nullptr, 0);
+        return entry;
+    }
+
+
+    void Cache::store(uint64_t key, size_t source_size, const std::vector<Token>& tokens,
+                      const Tree& tree, const SymbolTable& symbols,
+                      const Diagnostics& diagnostics) {
+        std::string data = serialize({&tokens, &tree, &symbols, &diagnostics, source_size, key});
+
+        // Write to a file of our own and rename it into place, so readers only ever see complete
+        // entries.
+        if (!make_directories(directory)) return;
+
+        static std::atomic<unsigned> counter(0);
+        std::string final_path = path(key);
+        std::string temp_path = final_path + temp_infix + std::to_string(getpid()) + "." +
+                                std::to_string(counter++);
+
+        int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) return;
+
+        bool ok = true;
+        for (size_t written = 0; ok && written < data.size(); ) {
+            ssize_t n = write(fd, data.data() + written, data.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            ok = n > 0;
+            written += ok ? n : 0;
+        }
+
+        ok &= close(fd) == 0;
+        if (!ok || rename(temp_path.c_str(), final_path.c_str()) != 0) {
+            unlink(temp_path.c_str());
+            return;
+        }
+
+        stored = true;
+    }
+
+
+    void Cache::evict() {
+        if (!stored) return;
+
+        DIR* dir = opendir(directory.c_str());
+        if (!dir) return;
+
+        struct Entry {
+            std::string path;
+            size_t size;
+            struct timespec mtime;
+        };
+
+        std::vector<Entry> entries;
+        size_t total = 0;
+        size_t suffix_len = std::strlen(entry_suffix);
+        time_t now = time(nullptr);
+        while (dirent* ent = readdir(dir)) {
+            std::string name = ent->d_name;
+            bool temp = name.find(temp_infix) != std::string::npos;
+            if (!temp && (name.size() <= suffix_len ||
+                          name.compare(name.size() - suffix_len, suffix_len, entry_suffix) != 0)) {
+                continue;
+            }
+
+            std::string entry_path = directory + "/" + name;
+            struct stat st;
+            if (stat(entry_path.c_str(), &st) != 0) continue;
+
+            // Other processes may still be writing recent temporary files.
+            if (temp) {
+                if (now - st.st_mtime > stale_temp_seconds) unlink(entry_path.c_str());
+                continue;
+            }
+
+            entries.push_back({entry_path, size_t(st.st_size), st.st_mtim});
+            total += st.st_size;
+        }
+
+        closedir(dir);
+        if (total <= max_size) return;
+
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            if (a.mtime.tv_sec != b.mtime.tv_sec) return a.mtime.tv_sec < b.mtime.tv_sec;
+            return a.mtime.tv_nsec < b.mtime.tv_nsec;
+        });
+
+        // Another process may be evicting at the same time, so entries can already be gone.
+        for (size_t i = 0; i < entries.size() && total > max_size; ++i) {
+            unlink(entries[i].path.c_str());
+            total -= entries[i].size;
+        }
+    }
+}
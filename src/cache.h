@@ -0,0 +1,70 @@
+#ifndef P_CACHE_H
+#define P_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "diagnostic.h"
+#include "intern.h"
+#include "lexer.h"
+#include "serialize.h"
+#include "source.h"
+
+
+namespace p {
+    // A cached compile result, mapped into memory and used in place.
+    class CacheEntry {
+    public:
+        // Whether the entry was found and is intact.
+        bool valid() const { return view.valid(); }
+
+        const UnitView& unit() const { return view; }
+
+    private:
+        friend class Cache;
+
+        SourceBuffer file;
+        UnitView view; // Of file, whose data doesn't move when the entry is moved.
+    };
+
+
+    // Directory of compile results keyed by the contents of the source and the compiler version,
+    // so unchanged files don't have to be compiled again. Entries are written atomically, so
+    // processes can share a cache, and evict removes the least recently used ones once the
+    // entries take up more than max_size bytes. Failing to use the cache is never an error, it
+    // just means compiling again.
+    class Cache {
+    public:
+        Cache(std::string directory, size_t max_size);
+
+        // The directory to use by default: $P_CACHE_DIR, or p in $XDG_CACHE_HOME or ~/.cache.
+        static std::string default_directory();
+
+        // The key of a source, given its bytes as read, when parsed with max_depth.
+        static uint64_t key(const uint8_t* data, size_t size, size_t max_depth);
+
+        // Returns the entry of key, which is invalid if there is none.
+        CacheEntry load(uint64_t key, size_t source_size);
+
+        void store(uint64_t key, size_t source_size, const std::vector<Token>& tokens,
+                   const Tree& tree, const SymbolTable& symbols, const Diagnostics& diagnostics);
+
+        // If anything was stored, removes the least recently used entries until the rest fit in
+        // max_size, and temporary files that writers left behind. This goes through the whole
+        // directory, so it's meant to be called once, after the last store.
+        void evict();
+
+    private:
+        std::string path(uint64_t key) const;
+
+        std::string directory;
+        size_t max_size;
+        std::atomic<bool> stored;
+    };
+}
+
+#endif
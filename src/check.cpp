@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "incremental.h"
+#include "lexer.h"
+#include "parse.h"
+
+
+// Checks incremental relexing and reparsing against lexing and parsing from scratch. Random
+// sources get random edits, after each of which the tokens, tree and diagnostics that relex and
+// reparse keep up to date must be the same as those of the edited source compiled anew. The
+// bracket errors check_brackets finds in it must be found by parsing too, and if it is valid,
+// parsing it lazily and expanding all blocks must give the same tree as parsing it.
+
+
+// Pieces that sources and edits are made of, biased towards brackets and newlines since those
+// decide how much is lexed and parsed again.
+static const char* const pieces[] = {
+    "foo", " ", "12u8", "\n", "{\n", "}\n", "(", "x", "# c\n", "+=", "{", "}", ")", "\"s\"", ".",
+    "-", " * ", ":", ",", "[", "]", "\"", "$"
+};
+static const size_t num_pieces = sizeof(pieces) / sizeof(pieces[0]);
+
+// Valid statements, and the braces of blocks, for sources that parse without errors.
+static const char* const statements[] = {
+    "foo\n", "{\n", "}\n", "x + 12u8 * foo\n", "f(x, [foo])\n", "x.foo[12u8]\n", "# c\n",
+    "-x : \"s\"\n", "f {\n", "(x +\nfoo)\n"
+};
+static const size_t num_statements = sizeof(statements) / sizeof(statements[0]);
+
+
+static bool same_tokens(const std::vector<p::Token>& a, const std::vector<p::Token>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].offset != b[i].offset || a[i].length != b[i].length ||
+            a[i].symbol != b[i].symbol || a[i].type != b[i].type) return false;
+    }
+
+    return true;
+}
+
+static bool same_nodes(const p::Tree& a, const p::AST& x, const p::Tree& b, const p::AST& y) {
+    if (x.type != y.type || x.begin != y.begin || x.end != y.end ||
+        x.num_children != y.num_children || x.token.offset != y.token.offset ||
+        x.token.type != y.token.type || x.token.symbol != y.token.symbol) return false;
+
+    for (uint32_t i = 0; i < x.num_children; ++i) {
+        if (!same_nodes(a, a.child(x, i), b, b.child(y, i))) return false;
+    }
+
+    return true;
+}
+
+// Diagnostics at the same offset may be recorded in any order.
+static bool same_diagnostics(const p::Diagnostics& a, const p::Diagnostics& b) {
+    auto sorted = [](const p::Diagnostics& diagnostics) {
+        std::vector<p::Diagnostic> list(diagnostics.begin(), diagnostics.end());
+        std::sort(list.begin(), list.end(), [](const p::Diagnostic& x, const p::Diagnostic& y) {
+            return x.offset != y.offset ? x.offset < y.offset : x.message < y.message;
+        });
+        return list;
+    };
+
+    std::vector<p::Diagnostic> x = sorted(a), y = sorted(b);
+    if (x.size() != y.size()) return false;
+    for (size_t i = 0; i < x.size(); ++i) {
+        if (x[i].offset != y[i].offset || x[i].message != y[i].message) return false;
+    }
+
+    return true;
+}
+
+// Parses tokens lazily and then expands every unparsed block, including those that expanding
+// others turns up, which gives the tree parse would.
+static p::Tree parse_expanded(const std::vector<p::Token>& tokens, p::Diagnostics& diagnostics) {
+    p::Tree tree = p::parse_lazy(tokens, diagnostics);
+    for (uint32_t i = 0; i < tree.nodes.size(); ++i) {
+        p::expand_block(tree, i, tokens, diagnostics);
+    }
+
+    return tree;
+}
+
+
+int main(int argc, char** argv) {
+    uint64_t seed = 1;
+    size_t num_sources = 2000, num_edits = 10;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = std::strtoull(argv[i] + 7, nullptr, 10);
+        } else if (std::strncmp(argv[i], "--sources=", 10) == 0) {
+            num_sources = std::strtoull(argv[i] + 10, nullptr, 10);
+        } else if (std::strncmp(argv[i], "--edits=", 8) == 0) {
+            num_edits = std::strtoull(argv[i] + 8, nullptr, 10);
+        } else {
+            std::fprintf(stdout, "Usage: %s [--seed=<n>] [--sources=<n>] [--edits=<n>]\n",
+                         argv[0]);
+            return 1;
+        }
+    }
+
+    std::mt19937_64 rng(seed);
+    auto below = [&](uint64_t n) { return size_t(rng() % n); };
+
+    size_t num_checked = 0, num_valid = 0;
+    for (size_t n = 0; n < num_sources; ++n) {
+        // Mostly balanced braces, so that edits usually stay within a block. Every other source
+        // is valid, until it is edited.
+        std::string source;
+        size_t depth = 0;
+        for (size_t length = below(80), i = 0; i < length; ++i) {
+            const char* piece = n % 2 ? statements[below(num_statements)] : pieces[below(10)];
+            if (std::strchr(piece, '{')) ++depth;
+            if (piece[0] == '}' && !depth) continue;
+            if (piece[0] == '}') --depth;
+            source += piece;
+        }
+        for (; depth; --depth) source += "}\n";
+
+        // Lexing and parsing errors are kept apart, as relex and reparse each update their own.
+        p::Interner symbols;
+        p::Diagnostics lex_errors, parse_errors;
+        auto data = [](const std::string& s) { return reinterpret_cast<const uint8_t*>(s.data()); };
+        std::vector<p::Token> tokens = p::lex_all(data(source), data(source) + source.size(),
+                                                  symbols, lex_errors);
+        p::TokenCursor cursor(tokens.data(), tokens.data() + tokens.size());
+        p::Tree tree = p::parse(cursor, parse_errors);
+
+        for (size_t e = 0; e < num_edits; ++e) {
+            p::Edit edit;
+            edit.offset = below(source.size() + 1);
+            edit.removed = std::min(below(4), source.size() - edit.offset);
+            std::string inserted;
+            for (size_t count = below(3), i = 0; i < count; ++i) {
+                inserted += pieces[below(num_pieces)];
+            }
+            edit.inserted = inserted.size();
+
+            std::string edited = source.substr(0, edit.offset) + inserted +
+                                 source.substr(edit.offset + edit.removed);
+            const uint8_t* begin = data(edited);
+            const uint8_t* end = begin + edited.size();
+
+            // The same symbol table, so that the same spellings get the same symbols.
+            p::relex(tokens, begin, end, edit, symbols, lex_errors);
+            p::Diagnostics expected_lex_errors;
+            std::vector<p::Token> expected_tokens = p::lex_all(begin, end, symbols,
+                                                               expected_lex_errors);
+
+            p::reparse(tree, tokens, edit, parse_errors);
+            p::Diagnostics expected_parse_errors;
+            p::TokenCursor expected_cursor(expected_tokens.data(),
+                                           expected_tokens.data() + expected_tokens.size());
+            p::Tree expected_tree = p::parse(expected_cursor, expected_parse_errors);
+
+            // Bracket errors are found by parsing too, so without parse errors there are none.
+            p::Diagnostics bracket_errors;
+            p::check_brackets(expected_tokens, 0, expected_tokens.size(), bracket_errors);
+
+            // Valid sources parse to the same tree lazily once all blocks are expanded.
+            p::Tree expanded_tree;
+            p::Diagnostics expanded_errors;
+            bool valid = expected_lex_errors.empty() && expected_parse_errors.empty();
+            if (valid) expanded_tree = parse_expanded(expected_tokens, expanded_errors);
+
+            const char* mismatch = nullptr;
+            if (!same_tokens(tokens, expected_tokens)) {
+                mismatch = "tokens";
+            } else if (!same_diagnostics(lex_errors, expected_lex_errors)) {
+                mismatch = "lex errors";
+            } else if (!same_nodes(tree, tree.nodes[tree.root], expected_tree,
+                                   expected_tree.nodes[expected_tree.root])) {
+                mismatch = "tree";
+            } else if (!same_diagnostics(parse_errors, expected_parse_errors)) {
+                mismatch = "parse errors";
+            } else if (!bracket_errors.empty() && expected_parse_errors.empty()) {
+                mismatch = "bracket and parse errors";
+            } else if (valid && (!expanded_errors.empty() ||
+                                 !same_nodes(expanded_tree, expanded_tree.nodes[expanded_tree.root],
+                                             expected_tree,
+                                             expected_tree.nodes[expected_tree.root]))) {
+                mismatch = "lazily parsed trees";
+            } else if (tree.nodes.size() - tree.unused != expected_tree.nodes.size() ||
+                       tree.unused > tree.nodes.size() / 2) {
+                // Replaced nodes must be counted, and dropped before they take over the tree.
+                mismatch = "unused node counts";
+            }
+
+            if (mismatch) {
+                std::fprintf(stdout, "%s differ after replacing %zu bytes at %zu by \"%s\" in:\n"
+                                     "%s\n", mismatch, edit.removed, edit.offset,
+                             inserted.c_str(), source.c_str());
+                return 1;
+            }
+
+            source = edited;
+            ++num_checked;
+            num_valid += valid;
+        }
+    }
+
+    std::printf("%zu edits checked, %zu of them leaving valid sources\n", num_checked,
+                num_valid);
+    return 0;
+}
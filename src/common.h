@@ -7,12 +7,10 @@
 #include "utf8/utf8.h"
 
 using u8str = std::basic_string<uint8_t>;
-using u32str = std::basic_string<char32_t>;
 
-inline std::string u32_to_string(u32str str) {
-    std::string result;
-    utf8::utf32to8(str.begin(), str.end(), std::back_inserter(result));
-    return result;
+// Whether byte is a UTF-8 continuation byte, i.e. not the start of a code point.
+inline bool is_continuation(uint8_t byte) {
+    return (byte & 0xc0) == 0x80;
 }
 
 #endif
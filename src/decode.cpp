@@ -0,0 +1,181 @@
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define P_X86_DISPATCH
+    #include <immintrin.h>
+#endif
+
+#include "decode.h"
+
+
+namespace p {
+    // Returns the number of leading ASCII bytes in [data, data + size), and sets has_cr if any of
+    // those bytes is a \r.
+    static size_t ascii_run_scalar(const uint8_t* data, size_t size, bool& has_cr) {
+        size_t i = 0;
+        while (i < size && data[i] < 0x80) has_cr |= data[i++] == '\r';
+        return i;
+    }
+
+#ifdef P_X86_DISPATCH
+    __attribute__((target("sse2")))
+    static size_t ascii_run_sse2(const uint8_t* data, size_t size, bool& has_cr) {
+        const __m128i cr = _mm_set1_epi8('\r');
+
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            unsigned high = _mm_movemask_epi8(v);
+            unsigned crs = _mm_movemask_epi8(_mm_cmpeq_epi8(v, cr));
+            if (high) {
+                unsigned n = __builtin_ctz(high);
+                has_cr |= (crs & ((1u << n) - 1)) != 0;
+                return i + n;
+            }
+
+            has_cr |= crs != 0;
+        }
+
+        return i + ascii_run_scalar(data + i, size - i, has_cr);
+    }
+
+    __attribute__((target("avx2")))
+    static size_t ascii_run_avx2(const uint8_t* data, size_t size, bool& has_cr) {
+        const __m256i cr = _mm256_set1_epi8('\r');
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            uint32_t high = _mm256_movemask_epi8(v);
+            uint32_t crs = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr));
+            if (high) {
+                unsigned n = __builtin_ctz(high);
+                has_cr |= (crs & ((uint64_t(1) << n) - 1)) != 0;
+                return i + n;
+            }
+
+            has_cr |= crs != 0;
+        }
+
+        return i + ascii_run_sse2(data + i, size - i, has_cr);
+    }
+#endif
+
+    using AsciiRunFn = size_t (*)(const uint8_t*, size_t, bool&);
+
+    static AsciiRunFn select_ascii_run() {
+#ifdef P_X86_DISPATCH
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return ascii_run_avx2;
+        if (__builtin_cpu_supports("sse2")) return ascii_run_sse2;
+#endif
+        return ascii_run_scalar;
+    }
+
+
+    // Returns the length of the multi-byte sequence starting at data, or 0 and sets error if it
+    // is not valid UTF-8. Rejects overlong encodings, surrogates and code points above U+10FFFF.
+    static size_t sequence_length(const uint8_t* data, const uint8_t* end, const char*& error) {
+        uint8_t lead = data[0];
+        size_t len;
+        uint8_t lo = 0x80, hi = 0xbf;
+        if (lead < 0xc2) {
+            error = "Invalid UTF-8 lead byte.";
+            return 0;
+        } else if (lead < 0xe0) {
+            len = 2;
+        } else if (lead < 0xf0) {
+            len = 3;
+            if (lead == 0xe0) lo = 0xa0;
+            if (lead == 0xed) hi = 0x9f;
+        } else if (lead < 0xf5) {
+            len = 4;
+            if (lead == 0xf0) lo = 0x90;
+            if (lead == 0xf4) hi = 0x8f;
+        } else {
+            error = "Invalid UTF-8 lead byte.";
+            return 0;
+        }
+
+        if (size_t(end - data) < len) {
+            error = "Truncated UTF-8 sequence.";
+            return 0;
+        }
+
+        if (data[1] < lo || data[1] > hi) {
+            error = data[1] < 0x80 || data[1] > 0xbf ? "Truncated UTF-8 sequence."
+                                                     : "Overlong or out of range UTF-8 sequence.";
+            return 0;
+        }
+
+        for (size_t i = 2; i < len; ++i) {
+            if ((data[i] & 0xc0) != 0x80) {
+                error = "Truncated UTF-8 sequence.";
+                return 0;
+            }
+        }
+
+        return len;
+    }
+
+
+    Utf8Scan scan_utf8(const uint8_t* data, size_t size) {
+        static const AsciiRunFn ascii_run = select_ascii_run();
+
+        Utf8Scan result = {size, nullptr, false};
+        size_t i = 0;
+        while (true) {
+            i += ascii_run(data + i, size - i, result.has_cr);
+            if (i == size) break;
+
+            size_t len = sequence_length(data + i, data + size, result.error);
+            if (!len) {
+                result.error_offset = i;
+                break;
+            }
+
+            i += len;
+        }
+
+        return result;
+    }
+
+
+    size_t count_code_points(const uint8_t* data, size_t size) {
+        size_t count = 0;
+        for (size_t i = 0; i < size; ++i) count += !is_continuation(data[i]);
+        return count;
+    }
+
+
+    u8str normalize_newlines(const uint8_t* data, size_t size) {
+        u8str result;
+        result.reserve(size);
+
+        const uint8_t* end = data + size;
+        while (true) {
+            auto cr = static_cast<const uint8_t*>(std::memchr(data, '\r', end - data));
+            if (!cr) break;
+
+            result.append(data, cr);
+            result += '\n';
+            data = cr + 1;
+            if (data != end && *data == '\n') ++data;
+        }
+
+        result.append(data, end);
+        return result;
+    }
+
+
+    bool decode_source(SourceBuffer& source, Diagnostics& diagnostics) {
+        Utf8Scan scan = scan_utf8(source.data(), source.size());
+        if (scan.error) {
+            diagnostics.error(Diagnostic::encoding, scan.error, scan.error_offset);
+            return false;
+        }
+
+        if (scan.has_cr) source = SourceBuffer(normalize_newlines(source.data(), source.size()));
+        return true;
+    }
+}
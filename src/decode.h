@@ -0,0 +1,35 @@
+#ifndef P_DECODE_H
+#define P_DECODE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "common.h"
+#include "diagnostic.h"
+#include "source.h"
+
+
+namespace p {
+    struct Utf8Scan {
+        size_t error_offset; // Offset of the first invalid sequence, or the input size if valid.
+        const char* error;   // Description of the error, nullptr if valid.
+        bool has_cr;         // Whether the input contains any \r that needs normalizing.
+    };
+
+    // Validates UTF-8 in a single pass over the input. Runs of ASCII are skipped with SSE2 or
+    // AVX2 (chosen at runtime) where available, multi-byte sequences are checked scalarly.
+    Utf8Scan scan_utf8(const uint8_t* data, size_t size);
+
+    // Returns the number of code points in valid UTF-8.
+    size_t count_code_points(const uint8_t* data, size_t size);
+
+    // Returns a copy of the input with newlines normalized \r | \n | \r\n -> \n.
+    u8str normalize_newlines(const uint8_t* data, size_t size);
+
+    // Checks that source is valid UTF-8, or records the first error in diagnostics and returns
+    // false. Also normalizes newlines, which only replaces the source by a copy if it contains
+    // a \r.
+    bool decode_source(SourceBuffer& source, Diagnostics& diagnostics);
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef P_DIAGNOSTIC_H
+#define P_DIAGNOSTIC_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace p {
+    // An error found in a source. Diagnostics only record the byte offset of the error in the
+    // source, use a LineIndex of the source to turn it into a line and column.
+    struct Diagnostic {
+        enum Kind : uint8_t {
+            syntax,
+            encoding
+        };
+
+        Kind kind;
+        size_t offset;
+        std::string message;
+    };
+
+
+    // Collects the errors of a compile. Recording an error doesn't stop anything, the lexer and
+    // parser skip to the next newline and carry on, so a single pass finds all errors.
+    class Diagnostics {
+    public:
+        void error(Diagnostic::Kind kind, std::string message, size_t offset) {
+            list.push_back({kind, offset, std::move(message)});
+        }
+
+        // Appends the diagnostics of other, whose offsets are relative to base.
+        void append(const Diagnostics& other, size_t base = 0) {
+            for (const Diagnostic& diagnostic : other.list) {
+                list.push_back(diagnostic);
+                list.back().offset += base;
+            }
+        }
+
+        // Replaces the diagnostics in [begin, end) with those of replacement, whose offsets are
+        // relative to base, and shifts the ones from end on by delta. This updates the
+        // diagnostics of a source after an edit, when [begin, end) was checked again.
+        void replace(size_t begin, size_t end, ptrdiff_t delta, const Diagnostics& replacement,
+                     size_t base = 0) {
+            std::vector<Diagnostic> result;
+            for (const Diagnostic& diagnostic : list) {
+                if (diagnostic.offset < begin) result.push_back(diagnostic);
+            }
+
+            for (const Diagnostic& diagnostic : replacement.list) {
+                result.push_back(diagnostic);
+                result.back().offset += base;
+            }
+
+            for (const Diagnostic& diagnostic : list) {
+                if (diagnostic.offset < end) continue;
+                result.push_back(diagnostic);
+                result.back().offset += delta;
+            }
+
+            list.swap(result);
+        }
+
+        // Orders the diagnostics by offset. The lexer runs a few tokens ahead of the parser, so
+        // they aren't always recorded in order.
+        void sort() {
+            std::stable_sort(list.begin(), list.end(),
+                             [](const Diagnostic& a, const Diagnostic& b) {
+                                 return a.offset < b.offset;
+                             });
+        }
+
+        bool empty() const { return list.empty(); }
+        size_t size() const { return list.size(); }
+        Diagnostic& operator[](size_t i) { return list[i]; }
+        const Diagnostic& operator[](size_t i) const { return list[i]; }
+        std::vector<Diagnostic>::const_iterator begin() const { return list.begin(); }
+        std::vector<Diagnostic>::const_iterator end() const { return list.end(); }
+
+    private:
+        std::vector<Diagnostic> list;
+    };
+}
+
+#endif
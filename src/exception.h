@@ -4,27 +4,7 @@
 #include "libop/op.h"
 
 namespace p {
-    struct CompilationError : public virtual op::BaseException {
-        size_t line;
-        size_t col;
-
-    protected:
-        CompilationError();
-        CompilationError(size_t line, size_t col) : line(line), col(col) { }
-    };
-
-    struct SyntaxError : public virtual CompilationError {
-        SyntaxError(std::string msg, size_t line, size_t col)
-        : op::BaseException(std::move(msg)), CompilationError(line, col) { }
-    protected: SyntaxError() { }
-    };
-
-    struct EncodingError : public virtual CompilationError {
-        EncodingError(std::string msg, size_t line, size_t col)
-        : op::BaseException(std::move(msg)), CompilationError(line, col) { }
-    protected: EncodingError() { }
-    };
-
+    // Errors in sources are not exceptions, they are recorded as Diagnostics (see diagnostic.h).
     struct FilesystemError : public virtual op::BaseException {
         FilesystemError(std::string msg) : op::BaseException(std::move(msg)) { }
     protected: FilesystemError() { }
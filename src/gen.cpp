@@ -0,0 +1,339 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+
+
+// Shape of the generated program. Sizes are in bytes unless noted otherwise.
+struct Options {
+    uint64_t seed = 1;
+    size_t lines = 10000;             // Total number of lines.
+    size_t line_length = 60;          // Target length of ordinary lines.
+    size_t long_lines = 0;            // Lines of long_line_length mixed in.
+    size_t long_line_length = 1 << 20;
+    size_t depth = 3;                 // Maximum nesting of random blocks and brackets.
+    size_t deep = 0;                  // Nesting of a single deeply nested statement.
+    size_t string_length = 16;        // Maximum length of ordinary strings.
+    size_t huge_strings = 0;          // String literals of huge_string_length mixed in.
+    size_t huge_string_length = 1 << 20;
+    unsigned numbers = 25;            // Percentage of atoms that are numbers.
+    bool unicode = false;             // Non-ASCII text in strings and comments.
+    bool crlf = false;
+};
+
+
+class Generator {
+public:
+    Generator(const Options& options)
+    : options(options), rng(options.seed), line_start(0), num_lines(0) {
+        for (int i = 0; i < 256; ++i) names.push_back(name());
+    }
+
+    ~Generator() {
+        flush();
+    }
+
+    void program() {
+        // Spread the special lines evenly over the program.
+        size_t specials = options.long_lines + options.huge_strings + (options.deep > 0);
+        size_t spacing = options.lines / (specials + 1) + 1;
+        size_t next_special = spacing;
+        size_t long_lines = options.long_lines, huge_strings = options.huge_strings;
+        bool deep = options.deep > 0;
+
+        for (num_lines = 0; num_lines < options.lines; ) {
+            if (specials && num_lines >= next_special) {
+                --specials;
+                next_special += spacing;
+                if (deep) {
+                    deep = false;
+                    deep_statement();
+                } else if (long_lines) {
+                    --long_lines;
+                    statement(0, options.long_line_length, false);
+                } else if (huge_strings) {
+                    --huge_strings;
+                    out += names[below(names.size())];
+                    out += ' ';
+                    string(options.huge_string_length);
+                    newline();
+                } else {
+                    statement(0, options.line_length, true);
+                }
+            } else if (chance(5)) {
+                comment();
+                newline();
+            } else {
+                statement(0, options.line_length, true);
+            }
+        }
+    }
+
+private:
+    // The std distributions aren't specified exactly, so they could give different programs for
+    // the same seed with different standard libraries. This only relies on mt19937_64 itself.
+    uint64_t below(uint64_t n) { return rng() % n; }
+    bool chance(unsigned percent) { return below(100) < percent; }
+
+    size_t line_length() const { return out.size() - line_start; }
+
+    void newline() {
+        out += options.crlf ? "\r\n" : "\n";
+        line_start = out.size();
+        ++num_lines;
+        if (out.size() >= 1 << 20) flush();
+    }
+
+    void flush() {
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        line_start -= out.size();
+        out.clear();
+    }
+
+    std::string name() {
+        const char* first = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+        const char* rest = "abcdefghijklmnopqrstuvwxyz0123456789_";
+
+        std::string result(1, first[below(53)]);
+        for (size_t i = below(10); i > 0; --i) result += rest[below(37)];
+        return result;
+    }
+
+    // Appends a random piece of text that may go in strings and comments.
+    void text_char() {
+        static const char* const non_ascii[] = {
+            "\xc3\xa9", "\xc3\x9f", "\xd0\xb6", "\xce\xbb", "\xe4\xb8\xad", "\xe2\x82\xac",
+            "\xf0\x9f\x98\x80", "\xf0\x9d\x94\xb8"
+        };
+
+        if (options.unicode && chance(20)) {
+            out += non_ascii[below(sizeof(non_ascii) / sizeof(*non_ascii))];
+        } else {
+            // Printable ASCII except quotes and backslashes.
+            char c = ' ' + below(95);
+            out += c == '"' || c == '\\' ? ' ' : c;
+        }
+    }
+
+    void string(size_t length) {
+        out += '"';
+        size_t start = out.size();
+        while (out.size() - start < length) {
+            if (chance(2)) out += "\\\"";
+            else text_char();
+        }
+        out += '"';
+    }
+
+    void comment() {
+        out += "# ";
+        for (size_t i = below(options.line_length + 1); i > 0; --i) text_char();
+    }
+
+    void number() {
+        static const char* const int_suffixes[] = {
+            "f32", "f64", "i8", "i16", "i32", "i64", "u8", "u16", "u32", "u64", "i"
+        };
+
+        auto digits = [&](const char* set, size_t n) {
+            for (size_t i = below(6) + 1; i > 0; --i) out += set[below(n)];
+        };
+
+        switch (below(5)) {
+        case 0:
+            out += "0b";
+            digits("01", 2);
+            break;
+        case 1:
+            out += "0o";
+            digits("01234567", 8);
+            break;
+        case 2:
+            out += "0x";
+            digits("0123456789", 10);
+            break;
+        case 3:
+            digits("0123456789", 10);
+            out += '.';
+            digits("0123456789", 10);
+            if (chance(50)) out += below(2) ? "f32" : "f64";
+            return;
+        default:
+            digits("0123456789", 10);
+            break;
+        }
+
+        if (chance(50)) out += int_suffixes[below(sizeof(int_suffixes) / sizeof(*int_suffixes))];
+    }
+
+    // Writes a number, string or name, and returns whether it was a name.
+    bool atom() {
+        unsigned kind = below(100);
+        if (kind < options.numbers) {
+            number();
+        } else if (kind < options.numbers + 10) {
+            string(below(options.string_length + 1));
+        } else {
+            out += chance(90) ? names[below(names.size())] : name();
+            return true;
+        }
+
+        return false;
+    }
+
+    // Writes what goes between two terms: a binary operator, a comma or just a space.
+    void separator() {
+        static const char* const operators[] = {
+            "+", "-", "*", "/", "//", "**", "%", "&", "|", "^", "<", "<<", ">", ">>",
+            "<=", ">=", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", ":"
+        };
+
+        unsigned kind = below(100);
+        if (kind < 30) {
+            out += ' ';
+            out += operators[below(sizeof(operators) / sizeof(*operators))];
+            out += ' ';
+        } else if (kind < 35) {
+            out += ", ";
+        } else {
+            out += ' ';
+        }
+    }
+
+    void group(size_t depth) {
+        bool square = chance(30);
+        out += square ? '[' : '(';
+        for (size_t i = below(4) + 1; i > 0; --i) {
+            term(depth + 1, false);
+            if (i > 1) separator();
+        }
+        out += square ? ']' : ')';
+    }
+
+    void block(size_t depth) {
+        out += '{';
+        newline();
+        for (size_t i = below(4) + 1; i > 0; --i) statement(depth + 1, options.line_length, true);
+        out += '}';
+    }
+
+    // Blocks contain newlines, so they are left out of lines that must stay in one piece. Names
+    // may be followed by calls, indexing and member accesses.
+    void term(size_t depth, bool blocks) {
+        if (depth < options.depth && chance(10)) {
+            if (blocks && chance(30)) block(depth);
+            else group(depth);
+            return;
+        }
+
+        if (chance(5)) out += '-';
+        if (!atom()) return;
+
+        while (chance(10)) {
+            if (depth < options.depth && chance(60)) {
+                group(depth);
+            } else {
+                out += '.';
+                out += names[below(names.size())];
+            }
+        }
+    }
+
+    // Writes terms until the current line is at least length bytes long, and a newline.
+    void statement(size_t depth, size_t length, bool blocks) {
+        term(depth, blocks);
+        while (line_length() < length) {
+            separator();
+            term(depth, blocks);
+        }
+
+        if (chance(10)) {
+            out += ' ';
+            comment();
+        }
+        newline();
+    }
+
+    // A single statement with options.deep nested brackets of every kind.
+    void deep_statement() {
+        static const char open[] = "([{", close[] = ")]}";
+
+        out += names[0];
+        out += ' ';
+        for (size_t i = 0; i < options.deep; ++i) out += open[i % 3];
+        atom();
+        for (size_t i = options.deep; i > 0; --i) out += close[(i - 1) % 3];
+        newline();
+    }
+
+    const Options& options;
+    std::mt19937_64 rng;
+    std::vector<std::string> names; // Identifiers that are used repeatedly.
+    std::string out;                // Output that hasn't been written yet.
+    size_t line_start;              // Offset of the current line in out.
+    size_t num_lines;
+};
+
+
+int main(int argc, char** argv) {
+    struct SizeOption {
+        const char* name;
+        size_t* value;
+    };
+
+    Options options;
+    size_t numbers = options.numbers;
+    const SizeOption size_options[] = {
+        {"--lines=", &options.lines},
+        {"--line-length=", &options.line_length},
+        {"--long-lines=", &options.long_lines},
+        {"--long-line-length=", &options.long_line_length},
+        {"--depth=", &options.depth},
+        {"--deep=", &options.deep},
+        {"--string-length=", &options.string_length},
+        {"--huge-strings=", &options.huge_strings},
+        {"--huge-string-length=", &options.huge_string_length},
+        {"--numbers=", &numbers},
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        bool known = true;
+        if (std::strncmp(argv[i], "--seed=", 7) == 0) {
+            options.seed = std::strtoull(argv[i] + 7, nullptr, 10);
+        } else if (std::strcmp(argv[i], "--unicode") == 0) {
+            options.unicode = true;
+        } else if (std::strcmp(argv[i], "--crlf") == 0) {
+            options.crlf = true;
+        } else {
+            known = false;
+            for (auto& option : size_options) {
+                size_t len = std::strlen(option.name);
+                if (std::strncmp(argv[i], option.name, len) == 0) {
+                    *option.value = std::strtoull(argv[i] + len, nullptr, 10);
+                    known = true;
+                }
+            }
+        }
+
+        if (!known || numbers > 70) {
+            std::fprintf(stdout, "Usage: %s [--seed=<n>] [--lines=<n>] [--line-length=<bytes>] "
+                                 "[--long-lines=<n>] [--long-line-length=<bytes>] "
+                                 "[--depth=<n>] [--deep=<n>] [--string-length=<bytes>] "
+                                 "[--huge-strings=<n>] [--huge-string-length=<bytes>] "
+                                 "[--numbers=<percent up to 70>] [--unicode] [--crlf]\n",
+                         argv[0]);
+            return 1;
+        }
+    }
+
+    options.numbers = numbers;
+
+    Generator generator(options);
+    generator.program();
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <cstring>
+
+#include "hash.h"
+
+
+namespace p {
+    static const uint64_t prime1 = 0x9e3779b185ebca87ull;
+    static const uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
+    static const uint64_t prime3 = 0x165667b19e3779f9ull;
+    static const uint64_t prime4 = 0x85ebca77c2b2ae63ull;
+    static const uint64_t prime5 = 0x27d4eb2f165667c5ull;
+
+    static inline uint64_t rotl(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    // Loads little-endian words, like the reference implementation on every platform.
+    static inline uint64_t read64(const uint8_t* p) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+        return v;
+    }
+
+    static inline uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap32(v);
+#endif
+        return v;
+    }
+
+    static inline uint64_t round(uint64_t acc, uint64_t input) {
+        return rotl(acc + input * prime2, 31) * prime1;
+    }
+
+    static inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+        return (acc ^ round(0, val)) * prime1 + prime4;
+    }
+
+
+    uint64_t hash64(const uint8_t* data, size_t size, uint64_t seed) {
+        const uint8_t* end = data + size;
+
+        uint64_t h;
+        if (size >= 32) {
+            // Four independent lanes over 32-byte stripes.
+            uint64_t v1 = seed + prime1 + prime2;
+            uint64_t v2 = seed + prime2;
+            uint64_t v3 = seed;
+            uint64_t v4 = seed - prime1;
+
+            const uint8_t* limit = end - 32;
+            do {
+                v1 = round(v1, read64(data));
+                v2 = round(v2, read64(data + 8));
+                v3 = round(v3, read64(data + 16));
+                v4 = round(v4, read64(data + 24));
+                data += 32;
+            } while (data <= limit);
+
+            h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+            h = merge_round(h, v1);
+            h = merge_round(h, v2);
+            h = merge_round(h, v3);
+            h = merge_round(h, v4);
+        } else {
+            h = seed + prime5;
+        }
+
+        h += size;
+
+        for (; data + 8 <= end; data += 8) {
+            h ^= round(0, read64(data));
+            h = rotl(h, 27) * prime1 + prime4;
+        }
+
+        if (data + 4 <= end) {
+            h ^= read32(data) * prime1;
+            h = rotl(h, 23) * prime2 + prime3;
+            data += 4;
+        }
+
+        for (; data < end; ++data) {
+            h ^= *data * prime5;
+            h = rotl(h, 11) * prime1;
+        }
+
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+        return h;
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef P_HASH_H
+#define P_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace p {
+    // XXH64 of [data, data + size). Fast on big inputs (several GB/s) and well distributed, used
+    // to identify file contents.
+    uint64_t hash64(const uint8_t* data, size_t size, uint64_t seed = 0);
+}
+
+#endif
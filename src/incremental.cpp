@@ -0,0 +1,255 @@
+#include <algorithm>
+
+#include "incremental.h"
+#include "parse.h"
+
+
+namespace p {
+    TokenEdit relex(std::vector<Token>& tokens, const uint8_t* begin, const uint8_t* end,
+                    const Edit& edit, SymbolTable& symbols, Diagnostics& diagnostics) {
+        // Nothing before the edit changed, and the lexer doesn't carry any state across
+        // newlines, so lexing can restart at the start of the line the edit begins on.
+        size_t start = edit.offset;
+        while (start && begin[start - 1] != '\n') --start;
+
+        auto by_offset = [](const Token& tok, size_t offset) { return tok.offset < offset; };
+        size_t first = std::lower_bound(tokens.begin(), tokens.end(), start, by_offset)
+                     - tokens.begin();
+
+        // Past the edit, the text in the new source at offset x was at x - delta in the old one.
+        // Once we lex a newline there that was also a newline token in the old tokens, all
+        // tokens after it are the same as before, just shifted.
+        size_t edit_end = edit.offset + edit.inserted;
+        ptrdiff_t delta = ptrdiff_t(edit.inserted) - ptrdiff_t(edit.removed);
+
+        std::vector<Token> relexed;
+        size_t old = first;
+        bool synced = false;
+        Diagnostics errors;
+        Lexer lexer(begin + start, end, symbols, errors);
+        while (true) {
+            Token tok = lexer.consume();
+            tok.offset += start;
+            relexed.push_back(tok);
+            if (tok.type == Token::Type::eof) break;
+            if (tok.type != Token::Type::newline || tok.offset < edit_end) continue;
+
+            size_t old_offset = tok.offset - delta;
+            while (old < tokens.size() && tokens[old].offset < old_offset) ++old;
+            if (old < tokens.size() && tokens[old].offset == old_offset &&
+                tokens[old].type == Token::Type::newline) {
+                ++old;
+                synced = true;
+                break;
+            }
+        }
+
+        // The old errors from start up to the newline the tokens lined up again at are replaced,
+        // those after it only moved.
+        size_t old_end = synced ? tokens[old - 1].offset + tokens[old - 1].length
+                                : ~size_t(0);
+        if (!synced) old = tokens.size();
+        diagnostics.replace(start, old_end, delta, errors, start);
+
+        // Splice in the new tokens and shift the ones after them.
+        TokenEdit result = {first, old - first, relexed.size()};
+        for (size_t i = old; i < tokens.size(); ++i) tokens[i].offset += delta;
+        if (result.inserted <= result.removed) {
+            std::copy(relexed.begin(), relexed.end(), tokens.begin() + first);
+            tokens.erase(tokens.begin() + first + result.inserted, tokens.begin() + old);
+        } else {
+            std::copy(relexed.begin(), relexed.begin() + result.removed, tokens.begin() + first);
+            tokens.insert(tokens.begin() + old, relexed.begin() + result.removed, relexed.end());
+        }
+
+        // Brackets around the edit may match differently now.
+        match_brackets(tokens, result.first, result.removed, result.inserted);
+
+        return result;
+    }
+
+
+    // A block enclosing an edit, how deep it is nested in brackets, and where it is on the path
+    // to it from the root.
+    struct EnclosingBlock {
+        uint32_t index;
+        size_t depth;
+        size_t level;
+    };
+
+    // The nodes containing an edit, from the root down. Each is the child at position of the one
+    // before it.
+    struct EnclosingPath {
+        std::vector<uint32_t> nodes;
+        std::vector<uint32_t> positions;
+        std::vector<EnclosingBlock> blocks;
+    };
+
+    // Returns the nodes containing [begin, end), and of those the brace blocks containing it
+    // strictly between their braces, outermost first, starting with the root.
+    static EnclosingPath enclosing_path(const Tree& tree, size_t begin, size_t end) {
+        EnclosingPath path;
+        path.nodes.push_back(tree.root);
+        path.positions.push_back(0);
+        path.blocks.push_back({tree.root, 0, 0});
+
+        uint32_t index = tree.root;
+        size_t depth = 0;
+        while (true) {
+            const AST& node = tree.nodes[index];
+
+            // Children are ordered by offset, find the last one starting before the edit.
+            uint32_t lo = 0, hi = node.num_children;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (tree.child(node, mid).begin < begin) lo = mid + 1;
+                else hi = mid;
+            }
+
+            if (!lo) break;
+            index = tree.children[node.first_child + lo - 1];
+
+            const AST& child = tree.nodes[index];
+            if (child.end < end) break;
+            path.nodes.push_back(index);
+            path.positions.push_back(lo - 1);
+            if (child.type == AST::Type::block || child.type == AST::Type::group) ++depth;
+            if (child.type == AST::Type::block && end < child.end) {
+                path.blocks.push_back({index, depth, path.nodes.size() - 1});
+            }
+        }
+
+        return path;
+    }
+
+
+    // Calls visit with every node of the subtrees on the stack, without recursing.
+    template<class Visit>
+    static void visit_subtrees(Tree& tree, std::vector<uint32_t>& stack, Visit visit) {
+        while (!stack.empty()) {
+            AST& node = tree.nodes[stack.back()];
+            stack.pop_back();
+            visit(node);
+            for (uint32_t i = 0; i < node.num_children; ++i) {
+                stack.push_back(tree.children[node.first_child + i]);
+            }
+        }
+    }
+
+    // Copies the nodes reachable from the root into new arenas, dropping those that reparse
+    // left behind.
+    static void compact(Tree& tree) {
+        Tree result;
+        result.root = result.nodes.push(tree.nodes[tree.root]);
+
+        // Breadth first, so the children of each node can be added to the new arena in one go.
+        for (uint32_t i = 0; i < result.nodes.size(); ++i) {
+            AST node = result.nodes[i];
+            if (node.type == AST::Type::unparsed) continue;
+
+            uint32_t first = result.children.size();
+            for (uint32_t c = 0; c < node.num_children; ++c) {
+                result.children.push(result.nodes.push(tree.child(node, c)));
+            }
+
+            result.nodes[i].first_child = first;
+        }
+
+        tree = std::move(result);
+    }
+
+
+    void reparse(Tree& tree, const std::vector<Token>& tokens, const Edit& edit,
+                 Diagnostics& diagnostics, size_t max_depth) {
+        size_t edit_end = edit.offset + edit.removed;
+        ptrdiff_t delta = ptrdiff_t(edit.inserted) - ptrdiff_t(edit.removed);
+
+        size_t source_end = tree.nodes[tree.root].end;
+
+        EnclosingPath path = enclosing_path(tree, edit.offset, edit_end);
+        uint32_t first_new = tree.nodes.size();
+        std::vector<EnclosingBlock>& blocks = path.blocks;
+        while (blocks.size() > 1) {
+            EnclosingBlock enclosing = blocks.back();
+            uint32_t index = enclosing.index;
+            blocks.pop_back();
+            AST old = tree.nodes[index];
+
+            // A block without a closing brace ends at the end of the source, and so do the
+            // errors about that. Those can't be told apart from the errors of the enclosing
+            // blocks there, so a block that reaches the end is reparsed with them.
+            if (old.end == source_end) continue;
+
+            // The opening brace is before the edit, so it's at the same index as before.
+            auto by_offset = [](const Token& tok, size_t offset) { return tok.offset < offset; };
+            size_t open = std::lower_bound(tokens.begin(), tokens.end(), old.begin, by_offset)
+                        - tokens.begin();
+
+            uint32_t old_size = tree.nodes.size();
+            Diagnostics errors;
+            TokenCursor cursor(tokens.data() + open + 1, tokens.data() + tokens.size());
+            uint32_t block = reparse_block(tree, cursor, tokens[open], enclosing.depth, max_depth,
+                                           errors);
+
+            // If the edit removed the closing brace, or added an unmatched opening one, the
+            // block now extends into the enclosing one and that is reparsed instead. What was
+            // parsed is left unused.
+            if (tree.nodes[block].end != old.end + delta) {
+                tree.unused += tree.nodes.size() - old_size;
+                continue;
+            }
+
+            diagnostics.replace(old.begin, old.end, delta, errors);
+
+            // Only what comes after the block moves: the ends of the nodes containing it, their
+            // tokens if those come after it (e.g. an operator after a block operand), and whole
+            // subtrees after those. The new nodes are already up to date.
+            auto shift = [&](AST& node) {
+                node.begin += delta;
+                node.end += delta;
+                node.token.offset += delta;
+            };
+
+            // Walking the subtrees after the block jumps around the arenas, so when most of the
+            // source comes after it a pass over all the nodes before the new ones is quicker.
+            // That shifts unused nodes too, which doesn't matter.
+            bool walk = old.end >= source_end / 2;
+            std::vector<uint32_t> stack;
+            for (size_t level = 0; level < enclosing.level; ++level) {
+                AST& node = tree.nodes[path.nodes[level]];
+                node.end += delta;
+                if (node.token.offset >= old.end) node.token.offset += delta;
+                for (uint32_t i = path.positions[level + 1] + 1; walk && i < node.num_children;
+                     ++i) {
+                    stack.push_back(tree.children[node.first_child + i]);
+                }
+            }
+
+            if (walk) {
+                visit_subtrees(tree, stack, shift);
+            } else {
+                for (uint32_t i = 0; i < first_new; ++i) {
+                    if (tree.nodes[i].begin >= old.end) shift(tree.nodes[i]);
+                }
+            }
+
+            // Nodes refer to their children by index, so overwriting the old block node in place
+            // links the new one into its parent. The old nodes in it, and the copied new one,
+            // are left unused.
+            size_t replaced = 0;
+            stack.push_back(index);
+            visit_subtrees(tree, stack, [&](AST&) { ++replaced; });
+            tree.unused += replaced;
+            tree.nodes[index] = tree.nodes[block];
+
+            // Copying the tree takes about as long as parsing the unused nodes did, so this adds
+            // at most a constant factor to reparsing.
+            if (tree.unused > tree.nodes.size() / 2) compact(tree);
+            return;
+        }
+
+        TokenCursor cursor(tokens.data(), tokens.data() + tokens.size());
+        diagnostics = Diagnostics();
+        tree = parse(cursor, diagnostics, max_depth);
+    }
+}
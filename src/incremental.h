@@ -0,0 +1,53 @@
+#ifndef P_INCREMENTAL_H
+#define P_INCREMENTAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ast.h"
+#include "diagnostic.h"
+#include "intern.h"
+#include "lexer.h"
+#include "parse.h"
+
+
+namespace p {
+    // A change to a source: removed bytes at offset were replaced by inserted bytes.
+    struct Edit {
+        size_t offset;
+        size_t removed;
+        size_t inserted;
+    };
+
+    // The tokens [first, first + removed) of a token array were replaced by the tokens
+    // [first, first + inserted), the offsets of all tokens after those were shifted.
+    struct TokenEdit {
+        size_t first;
+        size_t removed;
+        size_t inserted;
+    };
+
+    // Updates tokens, which were lexed from the source before edit, to the tokens of the source
+    // after it, [begin, end). This only lexes from the start of the line the edit starts on until
+    // the new tokens line up with the old ones again, which for edits within a line is just that
+    // line. diagnostics holds the errors found lexing the old source: those in the relexed lines
+    // are replaced by the new ones and those after them are shifted. tokens are left with matched
+    // brackets.
+    TokenEdit relex(std::vector<Token>& tokens, const uint8_t* begin, const uint8_t* end,
+                    const Edit& edit, SymbolTable& symbols, Diagnostics& diagnostics);
+
+    // Updates tree, parsed from the source before edit, given tokens, the tokens of the source
+    // after it (see relex). Only the innermost brace block containing the edit is reparsed, and
+    // if that doesn't end at the same closing brace as before (because brackets were added or
+    // removed) or it reaches the end of the source, its enclosing block instead. All other nodes
+    // are kept, and only those after the block have their offsets shifted. The replaced nodes
+    // stay in the arenas until they make up half of them, then the tree is copied without them.
+    // diagnostics holds the errors found parsing the old tree, without those of lexing (see
+    // relex): those in the reparsed block are replaced and those after it shifted. max_depth is
+    // as for parse.
+    void reparse(Tree& tree, const std::vector<Token>& tokens, const Edit& edit,
+                 Diagnostics& diagnostics, size_t max_depth = default_max_depth);
+}
+
+#endif
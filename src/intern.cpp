@@ -0,0 +1,154 @@
+#include <cstring>
+
+#include "intern.h"
+
+
+namespace p {
+    // Hashes a short byte string, eight bytes at a time.
+    static uint64_t hash_bytes(const uint8_t* str, size_t len) {
+        const uint64_t k = 0x9e3779b97f4a7c15ull;
+        uint64_t h = len * k;
+        while (len >= 8) {
+            uint64_t w;
+            std::memcpy(&w, str, 8);
+            h = (h ^ w) * k;
+            h ^= h >> 29;
+            str += 8;
+            len -= 8;
+        }
+
+        uint64_t w = 0;
+        std::memcpy(&w, str, len);
+        h = (h ^ w) * k;
+        h ^= h >> 32;
+        return h;
+    }
+
+
+    SymbolMap::Slot& SymbolMap::lookup(const uint8_t* str, uint32_t len, uint64_t hash) {
+        // insert keeps the load factor at or below 1/2, so there always is an empty slot.
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (!slot.str) return slot;
+            if (slot.hash == uint32_t(hash) && slot.length == len &&
+                std::memcmp(slot.str, str, len) == 0) return slot;
+        }
+    }
+
+    Spelling SymbolMap::insert(Slot& slot, const uint8_t* str, uint32_t len, uint64_t hash,
+                               uint32_t id) {
+        // Keep the load factor at or below 1/2. Growing moves the slots, so the empty one for
+        // str is looked up again.
+        Slot* target = &slot;
+        if (2 * (count + 1) > slots.size()) {
+            grow();
+            target = &lookup(str, len, hash);
+        }
+
+        target->str = store(str, len);
+        target->length = len;
+        target->hash = uint32_t(hash);
+        target->id = id;
+        ++count;
+        return {target->str, len};
+    }
+
+    void SymbolMap::grow() {
+        std::vector<Slot> old(2 * slots.size());
+        old.swap(slots);
+
+        // We only keep the low 32 bits of the hash, which is plenty to index the table.
+        size_t mask = slots.size() - 1;
+        for (const Slot& slot : old) {
+            if (!slot.str) continue;
+
+            size_t i = slot.hash & mask;
+            while (slots[i].str) i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+    }
+
+    const uint8_t* SymbolMap::store(const uint8_t* str, uint32_t len) {
+        const size_t block_size = 64 * 1024;
+
+        if (len > pool_left || !pool_ptr) {
+            // Oversized keys get a block of their own, leaving the current block in use.
+            if (len > block_size / 4) {
+                pool.emplace_back(new uint8_t[len]);
+                std::memcpy(pool.back().get(), str, len);
+                return pool.back().get();
+            }
+
+            pool.emplace_back(new uint8_t[block_size]);
+            pool_ptr = pool.back().get();
+            pool_left = block_size;
+        }
+
+        uint8_t* result = pool_ptr;
+        std::memcpy(result, str, len);
+        pool_ptr += len;
+        pool_left -= len;
+        return result;
+    }
+
+
+    uint32_t Interner::intern(const uint8_t* str, size_t len) {
+        uint64_t hash = hash_bytes(str, len);
+        SymbolMap::Slot& slot = map.lookup(str, len, hash);
+        if (slot.str) return slot.id;
+
+        uint32_t id = spellings.size();
+        spellings.push_back(map.insert(slot, str, len, hash, id));
+        return id;
+    }
+
+
+    ConcurrentInterner::ConcurrentInterner() : count(0) {
+        for (auto& chunk : chunks) chunk = nullptr;
+    }
+
+    ConcurrentInterner::~ConcurrentInterner() {
+        for (auto& chunk : chunks) delete[] chunk.load();
+    }
+
+    uint32_t ConcurrentInterner::intern(const uint8_t* str, size_t len) {
+        uint64_t hash = hash_bytes(str, len);
+
+        // The table uses the low bits of the hash, pick the shard with the high bits.
+        Shard& shard = shards[hash >> 60];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        SymbolMap::Slot& slot = shard.map.lookup(str, len, hash);
+        if (slot.str) return slot.id;
+
+        // The shard stays locked until the spelling is stored, so no other thread can see the
+        // id before that.
+        uint32_t id = count++;
+        locate(id) = shard.map.insert(slot, str, len, hash, id);
+        return id;
+    }
+
+    Spelling ConcurrentInterner::spelling(uint32_t id) const {
+        return locate(id);
+    }
+
+    // Finds the spelling of id as Arena does, allocating its chunk if it's the first id in it.
+    // Threads that start a chunk at the same time race to publish theirs, the losers free theirs.
+    Spelling& ConcurrentInterner::locate(uint32_t id) const {
+        uint64_t n = uint64_t(id) + (uint64_t(1) << first_chunk_bits);
+        unsigned high = 63 - __builtin_clzll(n);
+        std::atomic<Spelling*>& chunk = chunks[high - first_chunk_bits];
+
+        Spelling* spellings = chunk.load(std::memory_order_acquire);
+        if (!spellings) {
+            Spelling* fresh = new Spelling[uint64_t(1) << high];
+            if (chunk.compare_exchange_strong(spellings, fresh, std::memory_order_acq_rel)) {
+                spellings = fresh;
+            } else {
+                delete[] fresh;
+            }
+        }
+
+        return spellings[n - (uint64_t(1) << high)];
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef P_INTERN_H
+#define P_INTERN_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "common.h"
+
+
+namespace p {
+    // A stable reference to the bytes of an interned spelling.
+    struct Spelling {
+        const uint8_t* data;
+        uint32_t length;
+    };
+
+
+    // Maps each distinct spelling to a dense symbol id, so later passes can compare and hash
+    // names as integers. One table is shared by everything in a compilation.
+    class SymbolTable {
+    public:
+        static const uint32_t no_symbol = ~uint32_t(0);
+
+        virtual ~SymbolTable() { }
+
+        // Returns the id of the given spelling, assigning the next free id if it's new.
+        virtual uint32_t intern(const uint8_t* str, size_t len) = 0;
+        virtual Spelling spelling(uint32_t id) const = 0;
+        virtual size_t size() const = 0;
+    };
+
+
+    // Open-addressing (linear probing) hash table of spellings, owning copies of its keys. This
+    // is the building block of the interners below and does no locking itself.
+    class SymbolMap {
+    public:
+        struct Slot {
+            const uint8_t* str; // nullptr if the slot is empty.
+            uint32_t length;
+            uint32_t hash;
+            uint32_t id;
+        };
+
+        SymbolMap() : slots(16), count(0), pool_ptr(nullptr), pool_left(0) { }
+
+        // Returns the slot holding str, or the empty slot where it should be inserted.
+        Slot& lookup(const uint8_t* str, uint32_t len, uint64_t hash);
+
+        // Fills the empty slot returned by lookup with a copy of str, and returns that copy. The
+        // table grows here if it gets too full, which moves the slots.
+        Spelling insert(Slot& slot, const uint8_t* str, uint32_t len, uint64_t hash, uint32_t id);
+
+        size_t size() const { return count; }
+
+    private:
+        void grow();
+        const uint8_t* store(const uint8_t* str, uint32_t len);
+
+        std::vector<Slot> slots;
+        size_t count;
+
+        // Keys are bump-allocated from big blocks so that spellings stay put when we grow.
+        std::vector<std::unique_ptr<uint8_t[]>> pool;
+        uint8_t* pool_ptr;
+        size_t pool_left;
+    };
+
+
+    // Single-threaded interner.
+    class Interner : public SymbolTable {
+    public:
+        uint32_t intern(const uint8_t* str, size_t len) override;
+        Spelling spelling(uint32_t id) const override { return spellings[id]; }
+        size_t size() const override { return spellings.size(); }
+
+    private:
+        SymbolMap map;
+        std::vector<Spelling> spellings;
+    };
+
+
+    // Interner that can be shared between threads. Spellings are spread over independently
+    // locked shards by hash, new ids come from an atomic counter, so threads only contend when
+    // interning into the same shard. An id's spelling can be looked up by threads that got the
+    // id from intern or synchronized with one that did. size is only exact while nothing is
+    // being interned.
+    class ConcurrentInterner : public SymbolTable {
+    public:
+        ConcurrentInterner();
+        ~ConcurrentInterner();
+
+        uint32_t intern(const uint8_t* str, size_t len) override;
+        Spelling spelling(uint32_t id) const override;
+        size_t size() const override { return count; }
+
+    private:
+        struct alignas(64) Shard {
+            std::mutex mutex;
+            SymbolMap map;
+        };
+
+        // Spellings by id are kept in chunks that double in size, like the objects of an Arena,
+        // so they never move and each id's can be stored without a lock. Chunk k holds
+        // 2^(first_chunk_bits + k) of them, enough chunks for all 32-bit ids.
+        static const unsigned first_chunk_bits = 10;
+        static const unsigned num_chunks = 33 - first_chunk_bits;
+
+        Spelling& locate(uint32_t id) const;
+
+        std::array<Shard, 16> shards;
+        std::atomic<uint32_t> count;
+        mutable std::array<std::atomic<Spelling*>, num_chunks> chunks;
+    };
+}
+
+#endif
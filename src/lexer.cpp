@@ -1,202 +1,487 @@
-#include <cstring>
-
-#include "libop/op.h"
-
-#include "common.h"
-#include "exception.h"
-#include "lexer.h"
-
-
-namespace p {
-    const std::map<Token::Type, std::string> Token::type_names = {
-        {Token::Type::open_paren,   "open_paren"  },
-        {Token::Type::close_paren,  "close_paren" },
-        {Token::Type::open_square,  "open_square" },
-        {Token::Type::close_square, "close_square"},
-        {Token::Type::open_brace,   "open_brace"  },
-        {Token::Type::close_brace,  "close_brace" },
-        {Token::Type::colon,        "colon"       },
-        {Token::Type::comma,        "comma"       },
-        {Token::Type::period,       "period"      },
-        {Token::Type::comment,      "comment"     },
-        {Token::Type::identifier,   "identifier"  },
-        {Token::Type::newline,      "newline"     },
-        {Token::Type::number,       "number"      },
-        {Token::Type::oper,         "oper"        },
-        {Token::Type::string,       "string"      }
-    };
-
-
-    op::optional<Token> Lexer::get_token() {
-        static const char32_t operators[] = U"+-*/&|^%<>";
-        static const char32_t num[] = U"0123456789";
-        static const char32_t alpha[] =
-            U"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
-        static const char32_t alphanum[] =
-            U"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
-        static const char32_t brackets[] = U"(){}[]";
-        static const std::set<char32_t> operators_set(std::begin(operators), std::end(operators));
-        static const std::set<char32_t> num_set(std::begin(num), std::end(num));
-        static const std::set<char32_t> alpha_set(std::begin(alpha), std::end(alpha));
-        static const std::set<char32_t> alphanum_set(std::begin(alphanum), std::end(alphanum));
-        static const std::set<char32_t> brackets_set(std::begin(brackets), std::end(brackets));
-
-        static const std::map<char32_t, Token::Type> bracket_types = {
-            {U'(', Token::Type::open_paren},
-            {U')', Token::Type::close_paren},
-            {U'{', Token::Type::open_brace},
-            {U'}', Token::Type::close_brace},
-            {U'[', Token::Type::open_square},
-            {U']', Token::Type::close_square}
-        };
-
-        static const std::set<u32str> int_suffixes_set = {
-            U"f32", U"f64",
-            U"i8", U"i16", U"i32", U"i64",
-            U"u8", U"u16", U"u32", U"u64",
-            U"i"
-        };
-
-        // Check if we already have a cached token from peek_token.
-        if (token_cache.size())  {
-            op::optional<Token> tok = token_cache.front();
-            token_cache.pop_front();
-            return tok;
-        }
-
-        // Skip whitespace.
-        while (it != end && *it == U' ') {
-            ++it; ++col;
-        }
-
-        if (it == end) return {};
-
-        size_t token_col = col;
-        size_t token_line = line;
-
-        char32_t c = *it++; ++col;
-        if (c == U'\n') {
-            ++line;
-            col = 1;
-            return Token(Token::Type::newline, u32str(1, c), token_line, token_col);
-        }
-
-        if (brackets_set.count(c)) {
-            return Token(bracket_types.at(c), u32str(1, c), token_line, token_col);
-        } else if (c == U':') {
-            return Token(Token::Type::colon, u32str(1, c), token_line, token_col);
-        } else if (c == U',') {
-            return Token(Token::Type::comma, u32str(1, c), token_line, token_col);
-        } else if (c == U'.') {
-            return Token(Token::Type::period, u32str(1, c), token_line, token_col);
-        } else if (c == U'#') {
-            u32str value(1, c);
-            while (it != end && *it != U'\n') {
-                value += *it++; ++col;
-            }
-
-            return Token(Token::Type::comment, value, token_line, token_col);
-        } else if (c == U'"') {
-            u32str value;
-
-            while (true) {
-                if (it == end) {
-                    throw SyntaxError("EOF encountered in string.", token_line, col);
-                }
-
-                if (*it == U'\n') {
-                    throw SyntaxError("Newline encountered in string.", token_line, col);
-                }
-
-                if (*it == U'"') {
-                    ++it; ++col;
-                    break;
-                }
-
-                if (*it == U'\\') {
-                    ++it; ++col;
-                    if (it == end) {
-                        throw SyntaxError("EOF encountered in string.", token_line, col);
-                    }
-
-                    if (*it == U'"') {
-                        value += *it++; ++col;
-                    } else {
-                        value += U'\\';
-                    }
-                } else {
-                    value += *it++; ++col;
-                }
-            }
-
-            return Token(Token::Type::string, value, token_line, token_col);
-        } else if (operators_set.count(c)) {
-            u32str value(1, c);
-            if (it != end) {
-                if (((c == U'<' || c == U'>' || c == U'/' || c == U'*') && *it == c) || *it == U'=') {
-                    value += *it++; ++col;
-                }
-            }
-
-            return Token(Token::Type::oper, value, token_line, token_col);
-        } else if (alpha_set.count(c)) {
-            u32str value(1, c);
-            while (it != end && alphanum_set.count(*it)) {
-                value += *it++; ++col;
-            }
-
-            return Token(Token::Type::identifier, value, token_line, token_col);
-        } else if (num_set.count(c)) {
-            u32str value(1, c);
-            bool base = false;
-            bool floating = false;
-
-            if (c == U'0' && it != end && (*it == U'b' || *it == U'o' || *it == U'x')) {
-                base = true;
-                value += *it++; ++col;
-            }
-
-            while (it != end && num_set.count(*it)) {
-                value += *it++; ++col;
-            }
-
-            if (!base) {
-                if (it != end && *it == U'.') {
-                    floating = true;
-                    value += *it++; ++col;
-                }
-                
-                while (it != end && num_set.count(*it)) {
-                    value += *it++; ++col;
-                }
-            }
-
-            u32str suffix;
-            size_t suffix_col = col;
-            while (it != end && alphanum_set.count(*it)) {
-                suffix += *it++; ++col;
-            }
-
-            if (suffix.size()) {
-                if (floating && suffix != U"f32" && suffix != U"f64") {
-                    throw SyntaxError(
-                        std::string("Invalid float suffix '") + u32_to_string(suffix) + "'",
-                        token_line, suffix_col
-                    );
-                } else if (!floating && !int_suffixes_set.count(suffix)) {
-                    throw SyntaxError(
-                        std::string("Invalid integer suffix '") + u32_to_string(suffix) + "'",
-                        token_line, suffix_col
-                    );
-                }
-            }
-
-            return Token(Token::Type::number, value + suffix, token_line, token_col);
-        }
-
-        std::string c_str;
-        utf8::utf32to8(&c, &c + 1, std::back_inserter(c_str));
-        throw SyntaxError(std::string("Unknown character '") + c_str + "'",
-                          token_line, token_col);
-    }
-}
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+
+#include "libop/op.h"
+
+#include "common.h"
+#include "lexer.h"
+#include "trace.h"
+
+
+namespace p {
+    const std::map<Token::Type, std::string> Token::type_names = {
+        {Token::Type::open_paren,   "open_paren"  },
+        {Token::Type::close_paren,  "close_paren" },
+        {Token::Type::open_square,  "open_square" },
+        {Token::Type::close_square, "close_square"},
+        {Token::Type::open_brace,   "open_brace"  },
+        {Token::Type::close_brace,  "close_brace" },
+        {Token::Type::colon,        "colon"       },
+        {Token::Type::comma,        "comma"       },
+        {Token::Type::period,       "period"      },
+        {Token::Type::comment,      "comment"     },
+        {Token::Type::identifier,   "identifier"  },
+        {Token::Type::newline,      "newline"     },
+        {Token::Type::number,       "number"      },
+        {Token::Type::oper,         "oper"        },
+        {Token::Type::string,       "string"      },
+        {Token::Type::eof,          "eof"         }
+    };
+
+
+    const char* const operator_spellings[num_operators] = {
+        "+", "-", "*", "/", "//", "%", "**",
+        "<<", ">>", "&", "^", "|",
+        "<", ">", "<=", ">=",
+        ":",
+        "+=", "-=", "*=", "/=", "%=",
+        "&=", "^=", "|="
+    };
+
+
+    u8str Token::string_value(const uint8_t* source) const {
+        // Strip the quotes, the only escape sequence is \".
+        const uint8_t* it = source + offset + 1;
+        const uint8_t* end = source + offset + length - 1;
+
+        u8str value;
+        value.reserve(end - it);
+        while (it != end) {
+            if (*it == '\\' && it + 1 != end && it[1] == '"') ++it;
+            value += *it++;
+        }
+
+        return value;
+    }
+
+
+    // Character classes used by the lexer, as bit flags.
+    enum CharClass : uint8_t {
+        cc_operator = 1 << 0,
+        cc_digit    = 1 << 1,
+        cc_alpha    = 1 << 2,
+        cc_bracket  = 1 << 3,
+        cc_alphanum = cc_alpha | cc_digit
+    };
+
+    static constexpr uint8_t classify(unsigned c) {
+        return (c == '+' || c == '-' || c == '*' || c == '/' || c == '&' ||
+                c == '|' || c == '^' || c == '%' || c == '<' || c == '>') ? cc_operator
+             : (c >= '0' && c <= '9') ? cc_digit
+             : ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') ? cc_alpha
+             : (c == '(' || c == ')' || c == '{' || c == '}' || c == '[' || c == ']') ? cc_bracket
+             : 0;
+    }
+
+    // Class flags for every byte. Bytes >= 0x80 only occur as part of non-ASCII code points,
+    // which never start or continue a token outside of strings and comments, so they all map to
+    // the empty class.
+    #define P_CLASSIFY4(c) classify(c), classify(c + 1), classify(c + 2), classify(c + 3)
+    #define P_CLASSIFY16(c) \
+        P_CLASSIFY4(c), P_CLASSIFY4(c + 4), P_CLASSIFY4(c + 8), P_CLASSIFY4(c + 12)
+    #define P_CLASSIFY64(c) \
+        P_CLASSIFY16(c), P_CLASSIFY16(c + 16), P_CLASSIFY16(c + 32), P_CLASSIFY16(c + 48)
+    static constexpr uint8_t char_classes[256] = {
+        P_CLASSIFY64(0), P_CLASSIFY64(64), P_CLASSIFY64(128), P_CLASSIFY64(192)
+    };
+    #undef P_CLASSIFY64
+    #undef P_CLASSIFY16
+    #undef P_CLASSIFY4
+
+    static inline bool is_class(uint8_t c, uint8_t cls) {
+        return char_classes[c] & cls;
+    }
+
+    static Token::Type bracket_type(uint8_t c) {
+        switch (c) {
+            case '(': return Token::Type::open_paren;
+            case ')': return Token::Type::close_paren;
+            case '{': return Token::Type::open_brace;
+            case '}': return Token::Type::close_brace;
+            case '[': return Token::Type::open_square;
+            default:  return Token::Type::close_square;
+        }
+    }
+
+    // The operator spelled c followed by second, which is 0 for operators of one character.
+    static Operator operator_of(uint8_t c, uint8_t second) {
+        switch (c) {
+            case '+': return second ? op_add_assign : op_add;
+            case '-': return second ? op_subtract_assign : op_subtract;
+            case '*': return second == '*' ? op_power : second ? op_multiply_assign : op_multiply;
+            case '/':
+                return second == '/' ? op_floor_divide : second ? op_divide_assign : op_divide;
+            case '%': return second ? op_modulo_assign : op_modulo;
+            case '&': return second ? op_and_assign : op_and;
+            case '^': return second ? op_xor_assign : op_xor;
+            case '|': return second ? op_or_assign : op_or;
+            case '<': return second == '<' ? op_shift_left : second ? op_less_equal : op_less;
+            default:
+                return second == '>' ? op_shift_right : second ? op_greater_equal : op_greater;
+        }
+    }
+
+    static bool is_int_suffix(const uint8_t* suffix, size_t len) {
+        static const char* const int_suffixes[] = {
+            "f32", "f64",
+            "i8", "i16", "i32", "i64",
+            "u8", "u16", "u32", "u64",
+            "i"
+        };
+
+        for (const char* s : int_suffixes) {
+            if (std::strlen(s) == len && std::memcmp(s, suffix, len) == 0) return true;
+        }
+
+        return false;
+    }
+
+    static bool is_float_suffix(const uint8_t* suffix, size_t len) {
+        return len == 3 && suffix[0] == 'f' && ((suffix[1] == '3' && suffix[2] == '2') ||
+                                                (suffix[1] == '6' && suffix[2] == '4'));
+    }
+
+
+    Token Lexer::get_token() {
+        Token tok;
+        while (!lex_token(tok)) {
+            // Newlines always end a token, so lexing can pick up cleanly at the next one.
+            auto newline = static_cast<const uint8_t*>(std::memchr(it, '\n', end - it));
+            it = newline ? newline : end;
+        }
+
+        return tok;
+    }
+
+    bool Lexer::error(std::string message, const uint8_t* at) {
+        diagnostics.error(Diagnostic::syntax, std::move(message), at - source);
+        return false;
+    }
+
+    bool Lexer::lex_token(Token& tok) {
+        // Skip whitespace.
+        while (it != end && *it == ' ') ++it;
+        if (it == end) {
+            return make_token(tok, Token::Type::eof, it);
+        }
+
+        const uint8_t* start = it;
+        uint8_t c = *it++;
+        if (c == '\n') {
+            return make_token(tok, Token::Type::newline, start);
+        }
+
+        if (is_class(c, cc_bracket)) {
+            return make_token(tok, bracket_type(c), start);
+        } else if (c == ':') {
+            return make_token(tok, Token::Type::colon, start, op_colon);
+        } else if (c == ',') {
+            return make_token(tok, Token::Type::comma, start);
+        } else if (c == '.') {
+            return make_token(tok, Token::Type::period, start);
+        } else if (c == '#') {
+            auto newline = static_cast<const uint8_t*>(std::memchr(it, '\n', end - it));
+            it = newline ? newline : end;
+
+            return make_token(tok, Token::Type::comment, start);
+        } else if (c == '"') {
+            // Only validate the literal here, escapes are resolved by Token::string_value.
+            while (true) {
+                if (it == end) return error("EOF encountered in string.", it);
+                if (*it == '\n') return error("Newline encountered in string.", it);
+
+                if (*it == '"') {
+                    ++it;
+                    break;
+                }
+
+                if (*it == '\\') {
+                    ++it;
+                    if (it == end) return error("EOF encountered in string.", it);
+
+                    if (*it == '"') ++it;
+                } else {
+                    ++it;
+                }
+            }
+
+            return make_token(tok, Token::Type::string, start);
+        } else if (is_class(c, cc_operator)) {
+            uint8_t second = 0;
+            if (it != end) {
+                if (((c == '<' || c == '>' || c == '/' || c == '*') && *it == c) || *it == '=') {
+                    second = *it++;
+                }
+            }
+
+            return make_token(tok, Token::Type::oper, start, operator_of(c, second));
+        } else if (is_class(c, cc_alpha)) {
+            while (it != end && is_class(*it, cc_alphanum)) ++it;
+
+            uint32_t symbol = symbols.intern(start, it - start);
+            return make_token(tok, Token::Type::identifier, start, symbol);
+        } else if (is_class(c, cc_digit)) {
+            bool base = false;
+            bool floating = false;
+
+            if (c == '0' && it != end && (*it == 'b' || *it == 'o' || *it == 'x')) {
+                base = true;
+                ++it;
+            }
+
+            while (it != end && is_class(*it, cc_digit)) ++it;
+
+            if (!base) {
+                if (it != end && *it == '.') {
+                    floating = true;
+                    ++it;
+                }
+                
+                while (it != end && is_class(*it, cc_digit)) ++it;
+            }
+
+            const uint8_t* suffix = it;
+            while (it != end && is_class(*it, cc_alphanum)) ++it;
+
+            size_t suffix_len = it - suffix;
+            if (suffix_len) {
+                if (floating && !is_float_suffix(suffix, suffix_len)) {
+                    return error("Invalid float suffix '" + std::string(suffix, it) + "'", suffix);
+                } else if (!floating && !is_int_suffix(suffix, suffix_len)) {
+                    return error("Invalid integer suffix '" + std::string(suffix, it) + "'",
+                                 suffix);
+                }
+            }
+
+            uint32_t symbol = SymbolTable::no_symbol;
+            if (suffix_len) symbol = symbols.intern(suffix, suffix_len);
+            return make_token(tok, Token::Type::number, start, symbol);
+        }
+
+        // Everything that isn't ASCII ends up here, only now gather the rest of the code point.
+        std::string c_str(1, c);
+        while (it != end && is_continuation(*it)) c_str += *it++;
+        return error("Unknown character '" + c_str + "'", start);
+    }
+
+
+    // The lexer makes brackets without a symbol, so they start out unmatched.
+    static_assert(Token::no_match == SymbolTable::no_symbol, "Brackets must start unmatched");
+
+    static bool is_bracket(Token::Type type) {
+        return type <= Token::Type::close_brace;
+    }
+
+    static bool is_open_bracket(Token::Type type) {
+        return type == Token::Type::open_paren || type == Token::Type::open_square ||
+               type == Token::Type::open_brace;
+    }
+
+    // Matches the unmatched bracket tokens[i] with the innermost unmatched opening bracket before
+    // it, if it is a closing one. open holds the indices of the unmatched opening brackets.
+    static void match_bracket(std::vector<Token>& tokens, size_t i, std::vector<size_t>& open) {
+        if (is_open_bracket(tokens[i].type)) {
+            open.push_back(i);
+        } else if (!open.empty()) {
+            uint32_t distance = uint32_t(i - open.back());
+            tokens[i].symbol = distance;
+            tokens[open.back()].symbol = distance;
+            open.pop_back();
+        }
+    }
+
+
+    void match_brackets(std::vector<Token>& tokens) {
+        std::vector<size_t> open;
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            if (!is_bracket(tokens[i].type)) continue;
+            tokens[i].symbol = Token::no_match;
+            match_bracket(tokens, i, open);
+        }
+    }
+
+
+    void match_brackets(std::vector<Token>& tokens, size_t first, size_t removed,
+                        size_t inserted) {
+        // The brackets before first still open there, found walking back over matched pairs.
+        // An unmatched closing bracket means nothing before it was open.
+        std::vector<size_t> open;
+        for (size_t i = first; i--; ) {
+            const Token& tok = tokens[i];
+            if (!is_bracket(tok.type)) continue;
+            if (is_open_bracket(tok.type)) open.push_back(i);
+            else if (tok.symbol == Token::no_match) break;
+            else i -= tok.symbol;
+        }
+        std::reverse(open.begin(), open.end());
+
+        // Where the old match of each of them is now, if it wasn't replaced.
+        size_t suffix = first + inserted;
+        auto moved = [&](size_t i) {
+            size_t match = i + tokens[i].symbol;
+            if (tokens[i].symbol == Token::no_match || match < first + removed) {
+                return Token::no_match;
+            }
+            return uint32_t(match - removed + inserted - i);
+        };
+        std::vector<uint32_t> old_symbols;
+        for (size_t i : open) old_symbols.push_back(moved(i));
+
+        for (size_t i = first; i < suffix; ++i) {
+            if (is_bracket(tokens[i].type)) match_bracket(tokens, i, open);
+        }
+
+        // Pairs after the inserted tokens stay matched, only the closing brackets that closed
+        // something before them are matched again. Once one of those closes the same bracket
+        // as before, so do all later ones.
+        bool lined_up = false;
+        size_t i = suffix;
+        while (i < tokens.size()) {
+            Token& tok = tokens[i];
+            if (!is_bracket(tok.type)) {
+                ++i;
+            } else if (is_open_bracket(tok.type)) {
+                if (tok.symbol == Token::no_match) break;
+                i += tok.symbol + 1;
+            } else {
+                lined_up = !open.empty() && open.back() < first &&
+                           old_symbols[open.size() - 1] == i - open.back();
+                if (lined_up) break;
+                tok.symbol = Token::no_match;
+                match_bracket(tokens, i, open);
+                ++i;
+            }
+        }
+
+        // The brackets still open are closed where they were before if the matches lined up
+        // again, and not at all otherwise.
+        for (size_t j = 0; j < open.size(); ++j) {
+            uint32_t symbol = lined_up ? old_symbols[j] : Token::no_match;
+            tokens[open[j]].symbol = symbol;
+            if (symbol != Token::no_match) tokens[open[j] + symbol].symbol = symbol;
+        }
+    }
+
+
+    void check_brackets(const std::vector<Token>& tokens, size_t first, size_t last,
+                        Diagnostics& diagnostics) {
+        for (size_t i = first; i < last; ++i) {
+            const Token& tok = tokens[i];
+            if (!is_bracket(tok.type)) continue;
+
+            const std::string& name = Token::type_names.at(tok.type);
+            if (tok.symbol == Token::no_match) {
+                std::string problem = is_open_bracket(tok.type) ? "Unclosed '" : "Unmatched '";
+                diagnostics.error(Diagnostic::syntax, problem + name + "'.", tok.offset);
+                continue;
+            }
+
+            // Each kind of closing bracket directly follows its opening one in Token::Type.
+            if (is_open_bracket(tok.type)) continue;
+            Token::Type open = tokens[i - tok.symbol].type;
+            if (Token::Type(open + 1) != tok.type) {
+                diagnostics.error(Diagnostic::syntax,
+                                  "Mismatched '" + name + "', expected '" +
+                                  Token::type_names.at(Token::Type(open + 1)) + "'.", tok.offset);
+            }
+        }
+    }
+
+
+    std::vector<Token> lex_all(const uint8_t* begin, const uint8_t* end, SymbolTable& symbols,
+                               Diagnostics& diagnostics) {
+        std::vector<Token> tokens;
+        tokens.reserve((end - begin) / 4 + 1);
+
+        std::vector<size_t> open;
+        Lexer lexer(begin, end, symbols, diagnostics);
+        do {
+            tokens.push_back(lexer.consume());
+            if (is_bracket(tokens.back().type)) match_bracket(tokens, tokens.size() - 1, open);
+        } while (tokens.back().type != Token::Type::eof);
+
+        return tokens;
+    }
+
+
+    std::vector<Token> lex_parallel(const uint8_t* begin, const uint8_t* end,
+                                    SymbolTable& symbols, Diagnostics& diagnostics,
+                                    ThreadPool& pool) {
+        const size_t min_chunk_size = 1 << 20;
+
+        size_t size = end - begin;
+        size_t num_chunks = std::min(4 * pool.size(), size / min_chunk_size);
+        if (num_chunks < 2) return lex_all(begin, end, symbols, diagnostics);
+
+        // Split after the first newline following each evenly spaced point.
+        std::vector<const uint8_t*> bounds(1, begin);
+        for (size_t i = 1; i < num_chunks; ++i) {
+            const uint8_t* point = std::max(begin + size / num_chunks * i, bounds.back());
+            auto newline = static_cast<const uint8_t*>(std::memchr(point, '\n', end - point));
+            if (!newline) break;
+            bounds.push_back(newline + 1);
+        }
+
+        bounds.push_back(end);
+        num_chunks = bounds.size() - 1;
+
+        // Tokens and errors of each chunk, with offsets relative to the start of the chunk.
+        std::vector<std::vector<Token>> chunks(num_chunks);
+        std::vector<Diagnostics> chunk_diagnostics(num_chunks);
+        std::vector<std::exception_ptr> failures(num_chunks);
+        std::atomic<size_t> remaining(num_chunks);
+        for (size_t i = 0; i < num_chunks; ++i) {
+            pool.submit([&, i] {
+                TraceScope trace("lex chunk");
+                try {
+                    chunks[i] = lex_all(bounds[i], bounds[i + 1], symbols, chunk_diagnostics[i]);
+                    chunks[i].pop_back();
+                } catch (...) {
+                    // Only running out of memory gets here.
+                    failures[i] = std::current_exception();
+                }
+
+                --remaining;
+            });
+        }
+
+        pool.run_until([&] { return remaining == 0; });
+
+        TraceScope trace("merge chunks");
+
+        for (auto& failure : failures) {
+            if (failure) std::rethrow_exception(failure);
+        }
+
+        // Errors never span a newline, so they are the same as lexing serially would find.
+        for (size_t i = 0; i < num_chunks; ++i) {
+            diagnostics.append(chunk_diagnostics[i], bounds[i] - begin);
+        }
+
+        size_t num_tokens = 1;
+        for (auto& chunk : chunks) num_tokens += chunk.size();
+
+        // Brackets matched within a chunk are matched the same in the whole source, since they
+        // enclose only matched brackets. The others are matched across chunks here.
+        std::vector<Token> tokens;
+        std::vector<size_t> open;
+        tokens.reserve(num_tokens);
+        for (size_t i = 0; i < num_chunks; ++i) {
+            size_t base = bounds[i] - begin;
+            for (Token tok : chunks[i]) {
+                tok.offset += base;
+                tokens.push_back(tok);
+                if (is_bracket(tok.type) && tok.symbol == Token::no_match) {
+                    match_bracket(tokens, tokens.size() - 1, open);
+                }
+            }
+
+            std::vector<Token>().swap(chunks[i]);
+        }
+
+        tokens.push_back({size, 0, SymbolTable::no_symbol, Token::Type::eof});
+        return tokens;
+    }
+}
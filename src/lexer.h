@@ -1,12 +1,22 @@
 #ifndef P_LEXER_H
 #define P_LEXER_H
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
 #include "common.h"
+#include "diagnostic.h"
+#include "intern.h"
+#include "thread_pool.h"
 
 
 namespace p {
     struct Token {
-        enum Type {
+        enum Type : uint8_t {
             open_paren,
             close_paren,
             open_square,
@@ -21,39 +31,180 @@ namespace p {
             newline,
             number,
             oper,
-            string
+            string,
+            eof
         };
 
+        static const size_t num_types = size_t(eof) + 1;
         static const std::map<Token::Type, std::string> type_names;
 
-        Token(Type type, u32str value, size_t line, size_t col)
-        : type(type), value(value), line(line), col(col) { }
+        // The symbol of a bracket in a token array that has no matching bracket.
+        static const uint32_t no_match = ~uint32_t(0);
+
+        // The value of a string literal token, with escapes resolved.
+        u8str string_value(const uint8_t* source) const;
 
+        size_t offset;   // Byte offset of the token in the source.
+        uint32_t length; // Length of the token in bytes.
+        uint32_t symbol; // Interned spelling of an identifier, or of the suffix of a number. The
+                         // Operator of oper and colon tokens. For brackets in token arrays (see
+                         // match_brackets), the number of tokens to the matching bracket.
         Type type;
-        u32str value;
-        size_t line;
-        size_t col;
     };
 
 
+    // The operators that oper and colon tokens stand for.
+    enum Operator : uint32_t {
+        op_add, op_subtract, op_multiply, op_divide, op_floor_divide, op_modulo, op_power,
+        op_shift_left, op_shift_right, op_and, op_xor, op_or,
+        op_less, op_greater, op_less_equal, op_greater_equal,
+        op_colon,
+        op_add_assign, op_subtract_assign, op_multiply_assign, op_divide_assign, op_modulo_assign,
+        op_and_assign, op_xor_assign, op_or_assign,
+        num_operators
+    };
+
+    extern const char* const operator_spellings[num_operators];
+
+
+    // Number of tokens of each type.
+    using TokenCounts = std::array<size_t, Token::num_types>;
+
+
+    // Splits a source into tokens. Errors are recorded in diagnostics, with offsets relative to
+    // begin, after which lexing resumes at the next newline.
     class Lexer {
     public:
-        Lexer(u32str::iterator begin, u32str::iterator end)
-        : line(1), col(1), it(begin), end(end) { }
+        Lexer(const uint8_t* begin, const uint8_t* end, SymbolTable& symbols,
+              Diagnostics& diagnostics)
+        : source(begin), it(begin), end(end), symbols(symbols), diagnostics(diagnostics),
+          head(0), num_ahead(0), counts() { }
+
+        // Maximum number of tokens peek_token can look ahead.
+        static const size_t max_lookahead = 4;
+
+        // Returns the token ahead tokens from the current position without consuming it, ahead
+        // being from 1 to max_lookahead. At the end of the input this returns eof tokens. The
+        // reference stays valid until the token is consumed.
+        const Token& peek_token(size_t ahead = 1) {
+            // Looking further would overwrite tokens that haven't been consumed yet.
+            assert(ahead >= 1 && ahead <= max_lookahead);
 
-        op::optional<Token> get_token();
-        op::optional<Token> peek_token(int ahead = 1) { 
-            while (ahead > token_cache.size()) token_cache.push_back(get_token());
-            return token_cache[ahead - 1];
+            while (ahead > num_ahead) {
+                const Token& tok = lookahead[(head + num_ahead) % max_lookahead] = get_token();
+                if (tok.type != Token::Type::eof || !counts[tok.type]) ++counts[tok.type];
+                ++num_ahead;
+            }
+
+            return lookahead[(head + ahead - 1) % max_lookahead];
+        }
+
+        // Consumes the next token. The reference stays valid until the next call to peek_token or
+        // consume.
+        const Token& consume() {
+            const Token& tok = peek_token();
+            head = (head + 1) % max_lookahead;
+            --num_ahead;
+            return tok;
         }
 
+        // Number of tokens lexed so far of each type, including ones only peeked at. The eof
+        // tokens at the end count once, like the one ending a token array.
+        const TokenCounts& token_counts() const { return counts; }
+
     private:
-        size_t line;
-        size_t col;
-        u32str::iterator it;
-        u32str::iterator end;
-        std::deque<op::optional<Token>> token_cache;
+        Token get_token();
+
+        // Lexes the next token into tok, or records an error and returns false.
+        bool lex_token(Token& tok);
+        bool error(std::string message, const uint8_t* at);
+
+        bool make_token(Token& tok, Token::Type type, const uint8_t* start,
+                        uint32_t symbol = SymbolTable::no_symbol) const {
+            tok = {size_t(start - source), uint32_t(it - start), symbol, type};
+            return true;
+        }
+
+        const uint8_t* source;
+        const uint8_t* it;
+        const uint8_t* end;
+        SymbolTable& symbols;
+        Diagnostics& diagnostics;
+
+        // Ring buffer of tokens that have been peeked at but not yet consumed.
+        Token lookahead[max_lookahead];
+        size_t head;
+        size_t num_ahead;
+
+        TokenCounts counts;
     };
+
+
+    // Reads an array of tokens ending with an eof token through the same interface as Lexer. The
+    // brackets must be matched (see match_brackets) for the parser to skip them.
+    class TokenCursor {
+    public:
+        TokenCursor(const Token* begin, const Token* end)
+        : it(begin), end(end - 1), last(end[-1]) { }
+
+        // Reads [begin, end) followed by last, e.g. an eof token standing in for the rest of a
+        // bigger array.
+        TokenCursor(const Token* begin, const Token* end, const Token& last)
+        : it(begin), end(end), last(last) { }
+
+        const Token& peek_token(size_t ahead = 1) const {
+            return size_t(end - it) >= ahead ? it[ahead - 1] : last;
+        }
+
+        const Token& consume() {
+            return it != end ? *it++ : last;
+        }
+
+        // Consumes count tokens at once, stopping at the last token. Together with the bracket
+        // matches this skips a bracket and everything in it in constant time.
+        void skip(size_t count) { it += std::min(count, size_t(end - it)); }
+
+        // The next token to be read, as long as that isn't the last one.
+        const Token* position() const { return it; }
+
+    private:
+        const Token* it;
+        const Token* end;
+        Token last; // Repeated once the tokens before it have been read.
+    };
+
+
+    // Pairs up the brackets of tokens, storing in the symbol of each the number of tokens to its
+    // match in either direction, or Token::no_match. A closing bracket matches the innermost
+    // unmatched opening one whatever their kinds. That is only how the parser pairs them where
+    // they are all of the right kind: recovering from an error, it ends a group at any closing
+    // bracket and skips statements counting only braces.
+    void match_brackets(std::vector<Token>& tokens);
+
+    // Matches the brackets of tokens again after the matched tokens [first, first + removed)
+    // were replaced by the unmatched ones [first, first + inserted). Only those, the brackets
+    // open around them and the closing brackets after them that closed something before them
+    // until one closes the same bracket as before are looked at, the rest keep their matches.
+    void match_brackets(std::vector<Token>& tokens, size_t first, size_t removed,
+                        size_t inserted);
+
+    // Reports the brackets among tokens [first, last), which must be matched, that are unmatched
+    // or closed by a bracket of another kind. Those are errors that parsing would find too, this
+    // finds them without parsing, e.g. in blocks that parse_lazy skipped.
+    void check_brackets(const std::vector<Token>& tokens, size_t first, size_t last,
+                        Diagnostics& diagnostics);
+
+    // Lexes [begin, end) into an array of tokens, ending with an eof token, with matched
+    // brackets.
+    std::vector<Token> lex_all(const uint8_t* begin, const uint8_t* end, SymbolTable& symbols,
+                               Diagnostics& diagnostics);
+
+    // Like lex_all, but splits the source at newlines (which always end a token) into chunks that
+    // are lexed in parallel on pool. symbols must be safe to use from multiple threads, and the
+    // order in which symbol ids are assigned is not deterministic.
+    std::vector<Token> lex_parallel(const uint8_t* begin, const uint8_t* end,
+                                    SymbolTable& symbols, Diagnostics& diagnostics,
+                                    ThreadPool& pool);
 }
 
 #endif
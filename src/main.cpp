@@ -1,112 +1,490 @@
-#include <array>
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <cstdarg>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "utf8/utf8.h"
 
+#include "cache.h"
 #include "exception.h"
 #include "common.h"
+#include "decode.h"
 #include "parse.h"
+#include "serialize.h"
+#include "source.h"
+#include "stats.h"
+#include "stream.h"
+#include "thread_pool.h"
+#include "trace.h"
 
 
 
-// Reads a file as binary data.
-static u8str read_file(const char* filename) {
-    auto file = std::fopen(filename, "rb");
-    if (!file) throw p::FilesystemError(std::strerror(errno));
+// Returns the requested line, with an arrow at the requested column from the source.
+static std::string get_source_context(const uint8_t* source, const p::LineIndex& lines,
+                                      p::LineIndex::Location loc, int ident=0) {
+    std::string result(ident, ' ');
+    result.append(source + lines.line_begin(loc.line), source + lines.line_end(loc.line));
 
-    u8str result;
-    std::array<uint8_t, 4096> buf;
-    while (true) {
-        auto bytes_read = std::fread(buf.data(), 1, buf.size(), file);
-        if (std::ferror(file)) throw p::FilesystemError(std::strerror(errno));
-        
-        if (!bytes_read) break;
-        result.insert(result.end(), buf.begin(), buf.begin() + bytes_read);
-    }
+    result += '\n';
+    result += std::string(loc.col - 1 + ident, ' ');
+    result += '^';
 
     return result;
 }
 
 
-// Decodes binary blob as UTF-8 into an Unicode string, or throws EncodingError if there is an
-// error. Also normalizes newlines \r | \n | \r\n -> \n.
-template<class ForwardIterator>
-static u32str decode_utf8(ForwardIterator begin, ForwardIterator end) {
-    u32str result;
+// Appends printf-style formatted text to out.
+static void append_format(std::string& out, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int len = std::vsnprintf(nullptr, 0, fmt, args_copy);
+    va_end(args_copy);
 
-    size_t line = 1;
-    size_t col = 1;
-    while (begin != end) {
-        try {
-            char32_t c = utf8::next(begin, end);
-            if (c == U'\r') {
-                c = U'\n';
-                if (begin != end && utf8::peek_next(begin, end) == U'\n') ++begin;
+    size_t old_size = out.size();
+    out.resize(old_size + len + 1);
+    std::vsnprintf(&out[old_size], len + 1, fmt, args);
+    out.resize(old_size + len);
+    va_end(args);
+}
+
+
+// Formats a diagnostic, with context from the source for syntax errors. The line index covers
+// the source starting at byte offset base, which is at the start of line base_line.
+static void report(std::string& out, const char* filename, const p::Diagnostic& diagnostic,
+                   const uint8_t* source, const p::LineIndex& lines,
+                   size_t base = 0, size_t base_line = 1) {
+    auto loc = lines.locate(diagnostic.offset - base);
+    size_t line = loc.line + base_line - 1;
+    const char* message = diagnostic.message.c_str();
+
+    switch (diagnostic.kind) {
+    case p::Diagnostic::syntax:
+        append_format(out, "%s:%zu:%zu syntax error: %s\n", filename, line, loc.col, message);
+        append_format(out, "%s\n", get_source_context(source, lines, loc, 4).c_str());
+        break;
+    case p::Diagnostic::encoding:
+        append_format(out, "%s:%zu:%zu encoding error: %s\n", filename, line, loc.col, message);
+        break;
+    }
+}
+
+
+// What --emit writes for each compiled file, as a unit (see serialize.h).
+enum class Emit {
+    none,
+    tokens, // To <file>.tokens
+    ast     // To <file>.ast
+};
+
+
+// Writes a unit of a compiled file next to it, or to stdin.<extension> for stdin.
+static void emit_unit(std::string& out, const char* filename, Emit emit,
+                      const p::UnitContents& contents) {
+    p::TraceScope trace("emit");
+
+    std::string path = std::strcmp(filename, "-") == 0 ? "stdin" : filename;
+    path += emit == Emit::tokens ? ".tokens" : ".ast";
+
+    std::string data = p::serialize(contents);
+    FILE* file = std::fopen(path.c_str(), "wb");
+    bool ok = file && std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok &= file && std::fclose(file) == 0;
+    if (!ok) append_format(out, "error: %s: %s\n", path.c_str(), std::strerror(errno));
+}
+
+
+// Compiles a single file, appending its diagnostics to out. Big files are lexed in parallel.
+// Counters are added to stats if given. With a cache, files that were compiled before are
+// looked up instead, and the results of the others are stored in it. Emitting always compiles.
+// Brackets may be nested up to max_depth deep. For an outline, brace blocks are left unparsed
+// and only checked for bracket errors.
+static void compile_file(std::string& out, const char* filename, p::ThreadPool& pool,
+                         p::Cache* cache, Emit emit, bool outline, size_t max_depth,
+                         p::Stats* stats) {
+    const size_t parallel_lex_size = 8 << 20;
+
+    p::TraceScope trace("compile file", filename);
+
+    // Attributes the allocations made for this file since the end of the previous phase to
+    // phase, including those of jobs that help lexing it.
+    std::atomic<size_t> allocation_count(0);
+    p::AllocationScope allocation_scope(stats ? &allocation_count : nullptr);
+    size_t allocations = 0;
+    auto end_phase = [&](p::Stats::Phase phase) {
+        size_t count = allocation_count;
+        if (stats) stats->allocations[phase] += count - allocations;
+        allocations = count;
+    };
+
+    if (stats) ++stats->files;
+
+    p::SourceBuffer file;
+    try {
+        p::TraceScope trace("read");
+        file = p::read_source(filename);
+        end_phase(p::Stats::read);
+    } catch (const p::FilesystemError& e) {
+        append_format(out, "error: %s: %s\n", filename, e.what());
+        return;
+    }
+
+    if (stats) stats->bytes_read += file.size();
+
+    // The key covers the bytes as read, decoding may replace them.
+    size_t source_size = file.size();
+    uint64_t key = 0;
+    p::CacheEntry entry;
+    if (cache) {
+        p::TraceScope trace("cache lookup");
+        key = p::Cache::key(file.data(), file.size(), max_depth);
+        if (emit == Emit::none) entry = cache->load(key, source_size);
+    }
+
+    p::Diagnostics diagnostics;
+    if (entry.valid()) diagnostics = entry.unit().diagnostics();
+
+    // A cached file only has to be decoded for reporting errors in it, or counting code points.
+    bool decoded = true;
+    p::LineIndex lines;
+    if (!entry.valid() || !diagnostics.empty() || stats) {
+        {
+            p::TraceScope trace("decode");
+            // Cached files were decoded without errors before.
+            p::Diagnostics none;
+            decoded = p::decode_source(file, entry.valid() ? none : diagnostics);
+        }
+
+        p::TraceScope trace("line index");
+        lines = p::LineIndex(file.data(), file.size());
+        end_phase(p::Stats::decode);
+    }
+
+    // Without valid UTF-8 there is nothing to lex.
+    if (!decoded) {
+        report(out, filename, diagnostics[0], file.data(), lines);
+        return;
+    }
+
+    if (stats) stats->code_points += p::count_code_points(file.data(), file.size());
+
+    if (entry.valid()) {
+        const p::UnitView& unit = entry.unit();
+        if (stats) {
+            for (size_t i = 0; i < unit.num_tokens(); ++i) ++stats->tokens[unit.tokens()[i].type];
+            stats->ast_nodes += unit.num_nodes();
+            stats->arena_bytes += unit.num_nodes() * sizeof(p::AST) +
+                                  unit.num_children() * sizeof(uint32_t);
+            stats->symbols += unit.num_symbols();
+        }
+    } else {
+        bool parallel = file.size() >= parallel_lex_size && pool.size() > 1;
+        p::Interner interner;
+        p::ConcurrentInterner concurrent_interner;
+        p::SymbolTable& symbols = parallel ? static_cast<p::SymbolTable&>(concurrent_interner)
+                                           : interner;
+
+        p::TokenCounts* counts = stats ? &stats->tokens : nullptr;
+        p::Tree tree;
+        if (cache || emit != Emit::none || outline) {
+            // Storing the tokens, or skipping blocks, needs all of them at once, so the lexer
+            // can't feed the parser.
+            std::vector<p::Token> tokens;
+            {
+                p::TraceScope trace("lex");
+                if (parallel) {
+                    tokens = p::lex_parallel(file.begin(), file.end(), symbols, diagnostics, pool);
+                } else {
+                    tokens = p::lex_all(file.begin(), file.end(), symbols, diagnostics);
+                }
+            }
+
+            {
+                p::TraceScope trace("parse");
+                if (outline) {
+                    tree = p::parse_lazy(tokens, diagnostics, max_depth);
+                } else {
+                    p::TokenCursor cursor(tokens.data(), tokens.data() + tokens.size());
+                    tree = p::parse(cursor, diagnostics, max_depth);
+                }
+            }
+
+            // The tokens of each unparsed block are between its opening brace and the one
+            // matching it.
+            if (outline) {
+                p::TraceScope trace("check brackets");
+                for (uint32_t i = 0; i < tree.nodes.size(); ++i) {
+                    const p::AST& node = tree.nodes[i];
+                    if (node.type != p::AST::Type::unparsed) continue;
+                    size_t open = node.first_child;
+                    p::check_brackets(tokens, open + 1, open + tokens[open].symbol, diagnostics);
+                }
+            }
+
+            if (counts) {
+                for (const p::Token& tok : tokens) ++(*counts)[tok.type];
+            }
+
+            diagnostics.sort();
+            if (emit == Emit::tokens) {
+                emit_unit(out, filename, emit,
+                          {&tokens, nullptr, &symbols, &diagnostics, source_size, 0});
+            } else if (emit == Emit::ast) {
+                emit_unit(out, filename, emit,
+                          {nullptr, &tree, &symbols, &diagnostics, source_size, 0});
             }
-            
-            result += c;
-            if (c == U'\n') {
-                ++line;
-                col = 1;
-            } else ++col;
-        } catch (const utf8::exception& e) {
-            throw p::EncodingError(e.what(), line, col);
+
+            if (cache) {
+                p::TraceScope trace("cache store");
+                cache->store(key, source_size, tokens, tree, symbols, diagnostics);
+            }
+        } else if (parallel) {
+            tree = p::compile(file.begin(), file.end(), symbols, diagnostics, pool, counts,
+                              max_depth);
+        } else {
+            tree = p::compile(file.begin(), file.end(), symbols, diagnostics, counts, max_depth);
+        }
+
+        end_phase(p::Stats::compile);
+        if (stats) {
+            stats->ast_nodes += tree.nodes.size();
+            stats->arena_bytes += tree.nodes.bytes() + tree.children.bytes();
+            stats->symbols += symbols.size();
         }
     }
 
-    return result;
+    diagnostics.sort();
+    for (const p::Diagnostic& diagnostic : diagnostics) {
+        report(out, filename, diagnostic, file.data(), lines);
+    }
 }
 
 
-// Returns the requested line, with an arrow at the requested column from the source.
-template<class ForwardIterator>
-static u32str get_source_context(ForwardIterator begin, ForwardIterator end,
-                                 size_t line, size_t col, int ident=0) {
-    int cur_line = 1;
-    while (cur_line != line && begin != end) {
-        if (*begin++ == U'\n') cur_line += 1;
+// Lexes a file in bounded memory without holding it in memory as a whole, only checking it for
+// lexical and encoding errors.
+static void stream_file(std::string& out, const char* filename, size_t buffer_size,
+                        p::Stats* stats) {
+    p::TraceScope trace("stream file", filename);
+
+    if (stats) ++stats->files;
+
+    try {
+        p::Interner symbols;
+        p::Diagnostics diagnostics;
+        p::StreamLexer lexer(filename, symbols, diagnostics, buffer_size);
+
+        // Errors have to be reported while their line is still in the window.
+        size_t num_reported = 0;
+        while (true) {
+            p::Token tok = lexer.next();
+            if (stats) ++stats->tokens[tok.type];
+
+            if (num_reported < diagnostics.size()) {
+                p::LineIndex lines(lexer.window_data(), lexer.window_size());
+                for (; num_reported < diagnostics.size(); ++num_reported) {
+                    report(out, filename, diagnostics[num_reported], lexer.window_data(), lines,
+                           lexer.window_offset(), lexer.window_line());
+                }
+            }
+
+            if (tok.type == p::Token::Type::eof) break;
+        }
+
+        if (stats) {
+            stats->bytes_read += lexer.bytes_read();
+            stats->code_points += lexer.code_points();
+            stats->symbols += symbols.size();
+        }
+    } catch (const p::FilesystemError& e) {
+        append_format(out, "error: %s: %s\n", filename, e.what());
     }
+}
 
-    u32str result(ident, U' ');
-    while (begin != end && *begin != U'\n') result += *begin++;
 
-    result += U'\n';
-    result += u32str(col - 1 + ident, U' ');
-    result += U'^';
+static void print_stats(const p::Stats& stats) {
+    size_t num_tokens = 0;
+    for (size_t count : stats.tokens) num_tokens += count;
 
-    return result;
+    std::printf("files:             %zu\n", stats.files);
+    std::printf("bytes read:        %zu\n", stats.bytes_read);
+    std::printf("code points:       %zu\n", stats.code_points);
+    std::printf("tokens:            %zu\n", num_tokens);
+    for (auto& type : p::Token::type_names) {
+        std::printf("  %-16s %zu\n", (type.second + ":").c_str(), stats.tokens[type.first]);
+    }
+
+    std::printf("AST nodes:         %zu\n", stats.ast_nodes);
+    std::printf("arena bytes:       %zu\n", stats.arena_bytes);
+    std::printf("symbols:           %zu\n", stats.symbols);
+    std::printf("allocations:\n");
+    std::printf("  read:            %zu\n", stats.allocations[p::Stats::read]);
+    std::printf("  decode:          %zu\n", stats.allocations[p::Stats::decode]);
+    std::printf("  compile:         %zu\n", stats.allocations[p::Stats::compile]);
+    std::printf("peak RSS:          %zu\n", p::peak_rss());
 }
 
 
+// Directories that have been searched, by device and inode.
+using Visited = std::set<std::pair<dev_t, ino_t>>;
+
+// Adds path to files, or if it's a directory every .p file below it, in sorted order. Symbolic
+// links are followed, but a directory that was searched before, e.g. through a link to one of
+// its parents, isn't searched again.
+static void collect_files(const std::string& path, std::vector<std::string>& files,
+                          Visited& visited) {
+    struct stat st;
+    if (path == "-" || stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        // Errors opening the file are reported when compiling it.
+        files.push_back(path);
+        return;
+    }
+
+    if (!visited.insert(std::make_pair(st.st_dev, st.st_ino)).second) return;
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        files.push_back(path);
+        return;
+    }
+
+    std::vector<std::string> entries;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+
+        std::string child = path + (path.back() == '/' ? "" : "/") + name;
+        bool is_dir = stat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        if (is_dir || (name.size() > 2 && name.compare(name.size() - 2, 2, ".p") == 0)) {
+            entries.push_back(child);
+        }
+    }
+
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+    for (auto& entry : entries) collect_files(entry, files, visited);
+}
 
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        std::fprintf(stdout, "Usage: %s <file>\n", argv[0]);
+    std::vector<std::string> files;
+    Visited visited;
+    bool stream = false;
+    bool outline = false;
+    size_t stream_buffer = 1 << 20;
+    size_t num_threads = 0;
+    const char* trace_file = nullptr;
+    bool print_stats_after = false;
+    std::string cache_dir;
+    Emit emit = Emit::none;
+    bool bad_emit = false;
+    size_t cache_size = size_t(1) << 30;
+    size_t max_depth = p::default_max_depth;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--stream") == 0) {
+            stream = true;
+        } else if (std::strncmp(argv[i], "--stream-buffer=", 16) == 0) {
+            stream = true;
+            stream_buffer = std::strtoull(argv[i] + 16, nullptr, 10);
+        } else if (std::strcmp(argv[i], "--outline") == 0) {
+            outline = true;
+        } else if (std::strcmp(argv[i], "--stats") == 0) {
+            print_stats_after = true;
+        } else if (std::strncmp(argv[i], "--emit=", 7) == 0) {
+            if (std::strcmp(argv[i] + 7, "tokens") == 0) emit = Emit::tokens;
+            else if (std::strcmp(argv[i] + 7, "ast") == 0) emit = Emit::ast;
+            else bad_emit = true;
+        } else if (std::strcmp(argv[i], "--cache") == 0) {
+            cache_dir = p::Cache::default_directory();
+        } else if (std::strncmp(argv[i], "--cache-dir=", 12) == 0) {
+            cache_dir = argv[i] + 12;
+        } else if (std::strncmp(argv[i], "--cache-size=", 13) == 0) {
+            cache_size = std::strtoull(argv[i] + 13, nullptr, 10);
+        } else if (std::strncmp(argv[i], "--max-depth=", 12) == 0) {
+            max_depth = std::strtoull(argv[i] + 12, nullptr, 10);
+        } else if (std::strcmp(argv[i], "--time-trace") == 0) {
+            trace_file = "trace.json";
+        } else if (std::strncmp(argv[i], "--time-trace=", 13) == 0) {
+            trace_file = argv[i] + 13;
+        } else if (std::strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) {
+            num_threads = std::strtoull(argv[i] + 2, nullptr, 10);
+        } else {
+            collect_files(argv[i], files, visited);
+        }
+    }
+
+    if (files.empty() || !stream_buffer || (trace_file && !*trace_file) || bad_emit ||
+        ((stream || outline) && emit != Emit::none) || (stream && outline)) {
+        std::fprintf(stdout, "Usage: %s [-j<threads>] [--stream | --stream-buffer=<bytes>] "
+                             "[--outline] [--emit=tokens | --emit=ast] "
+                             "[--cache | --cache-dir=<dir>] [--cache-size=<bytes>] "
+                             "[--max-depth=<n>] "
+                             "[--time-trace[=<file>]] [--stats] <file | directory | ->...\n",
+                     argv[0]);
         return 1;
     }
 
-    u32str decoded_file;
-    try {
-        auto file = read_file(argv[1]);
-        decoded_file = decode_utf8(file.begin(), file.end());
-        p::compile(decoded_file.begin(), decoded_file.end());
-    } catch (const p::SyntaxError& e) {
-        std::fprintf(stdout, "%s:%zu:%zu syntax error: %s\n", argv[1], e.line, e.col, e.what());
-        std::fprintf(stdout, "%s\n",
-            u32_to_string(get_source_context(decoded_file.begin(), decoded_file.end(),
-                                             e.line, e.col, 4)).c_str());
-    } catch (const p::EncodingError& e) {
-        std::fprintf(stdout, "%s:%zu:%zu encoding error: %s\n", argv[1], e.line, e.col, e.what());
-    } catch (const p::CompilationError& e) {
-        std::fprintf(stdout, "%s:%zu:%zu %s\n", argv[1], e.line, e.col, e.what());
-    } catch (const p::FilesystemError& e) {
-        std::fprintf(stdout, "error: %s: %s\n", argv[1], e.what());
+    if (trace_file) p::enable_tracing();
+
+    // Streaming doesn't produce a tree and an outline only part of one, so there is nothing to
+    // cache.
+    std::unique_ptr<p::Cache> cache;
+    if (!cache_dir.empty() && !stream && !outline) {
+        cache.reset(new p::Cache(cache_dir, cache_size));
     }
 
+    // Every file is compiled independently, diagnostics are printed in the order the files were
+    // given in once all of them are done. Workers without a file of their own help lexing big
+    // files.
+    std::vector<std::string> output(files.size());
+    std::vector<p::Stats> stats(files.size());
+    {
+        p::ThreadPool pool(num_threads);
+        for (size_t i = 0; i < files.size(); ++i) {
+            pool.submit([&, i] {
+                p::Stats* file_stats = print_stats_after ? &stats[i] : nullptr;
+                if (stream) {
+                    stream_file(output[i], files[i].c_str(), stream_buffer, file_stats);
+                } else {
+                    compile_file(output[i], files[i].c_str(), pool, cache.get(), emit, outline,
+                                 max_depth, file_stats);
+                }
+            });
+        }
 
-    return 0;
-}
+        pool.wait();
+    }
+
+    if (cache) cache->evict();
+
+    for (auto& out : output) std::fputs(out.c_str(), stdout);
+
+    if (print_stats_after) {
+        p::Stats total;
+        for (auto& file_stats : stats) total += file_stats;
+        print_stats(total);
+    }
 
+    if (trace_file) {
+        try {
+            p::write_trace(trace_file);
+        } catch (const p::FilesystemError& e) {
+            std::fprintf(stdout, "error: %s: %s\n", trace_file, e.what());
+            return 1;
+        }
+    }
 
+    return 0;
+}
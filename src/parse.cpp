@@ -1,23 +1,719 @@
-#include <memory>
+#include <string>
+#include <vector>
 
 #include "libop/op.h"
 
 #include "ast.h"
+#include "diagnostic.h"
 #include "parse.h"
 #include "lexer.h"
+#include "trace.h"
 
-static std::shared_ptr<AST> parse(Lexer& lexer);
-static std::shared_ptr<AST> parse_block(Lexer& lexer);
-static std::shared_ptr<AST> parse_expression(Lexer& lexer);
+using namespace p;
 
-static std::shared_ptr<AST> parse(Lexer& lexer) {
-    return parse_block(lexer);
+
+// Stands for no node, e.g. for an expression that is an error.
+static const uint32_t no_node = ~0u;
+
+
+namespace {
+    // How tightly each Operator binds as a binary operator, higher levels first, and whether it
+    // groups to the right.
+    struct Precedence {
+        uint8_t level;
+        bool right;
+    };
+
+    constexpr Precedence precedences[num_operators] = {
+        {8, false}, {8, false},                                     // + -
+        {9, false}, {9, false}, {9, false}, {9, false},             // * / // %
+        {11, true},                                                 // **
+        {7, false}, {7, false},                                     // << >>
+        {6, false}, {5, false}, {4, false},                         // & ^ |
+        {3, false}, {3, false}, {3, false}, {3, false},             // < > <= >=
+        {2, false},                                                 // :
+        {1, true}, {1, true}, {1, true}, {1, true}, {1, true},      // += -= *= /= %=
+        {1, true}, {1, true}, {1, true}                             // &= ^= |=
+    };
+
+    // Prefix + and - bind tighter than any binary operator but **, so -a ** b is -(a ** b).
+    const uint8_t prefix_level = 10;
+
+
+    // An operator whose right operand is still being parsed.
+    struct PendingOperator {
+        Token token;
+        uint8_t level;
+        bool prefix;
+    };
+
+
+    // A bracket that is being parsed, or the root block.
+    struct Frame {
+        Token open;             // An eof token for the root block.
+        uint32_t callee;        // The operand a call or index bracket follows, or no_node.
+        size_t base;            // Where the children of the bracket start in Parser::scratch.
+        size_t end;             // End of the last child of a group so far.
+
+        // The statement being parsed in a block.
+        Token first;
+        size_t statement_base;
+        size_t statement_end;
+
+        // Where the expression being parsed starts on the operator and operand stacks.
+        size_t operators_base;
+        size_t operands_base;
+    };
+
+
+    // What the parser expects next in the innermost frame.
+    enum class State {
+        block,      // A statement, or the end of the block.
+        statement,  // An expression, or the end of the statement.
+        group,      // An expression, or the end of the group.
+        operand,    // An operand, possibly after prefix operators.
+        postfix,    // Calls, indexing or member accesses of the operand.
+        operators   // An operator, or the end of the expression.
+    };
+
+
+    // Parser state. Source is where the tokens come from, either a Lexer or a TokenCursor.
+    template<class Source>
+    struct Parser {
+        Parser(Source& lexer, Tree& tree, Diagnostics& diagnostics, size_t max_depth,
+               size_t depth, const Token* lazy)
+        : lexer(lexer), tree(tree), diagnostics(diagnostics), max_depth(max_depth), depth(depth),
+          lazy(lazy), recovering(false) { }
+
+        Source& lexer;
+        Tree& tree;
+        Diagnostics& diagnostics;
+
+        // Indices of the children of the nodes under construction. Each node collects its
+        // children on top of this stack, and copies them into the tree when it is finished.
+        std::vector<uint32_t> scratch;
+
+        // The operators and operands of the expressions being parsed, each expression using the
+        // top of the stacks.
+        std::vector<PendingOperator> operators;
+        std::vector<uint32_t> operands;
+
+        // The brackets being parsed, innermost last. The outermost one is nested depth deep in
+        // the whole source, and nesting is limited to max_depth brackets.
+        std::vector<Frame> frames;
+        size_t max_depth;
+        size_t depth;
+
+        // In a lazy parse, the start of the token array, from which the brace blocks that are
+        // left unparsed are indexed. Null otherwise.
+        const Token* lazy;
+
+        // Set after an error until the rest of the statement has been skipped. Meanwhile groups
+        // end where they are and further errors aren't reported, since they'd only be caused by
+        // the first one.
+        bool recovering;
+    };
+}
+
+
+// Finishes a node whose children are the entries of the scratch stack starting at base.
+template<class Source>
+static uint32_t make_node(Parser<Source>& parser, AST::Type type, const Token& token,
+                          size_t begin, size_t end, size_t base) {
+    Tree& tree = parser.tree;
+    AST node = {type, tree.children.size(), uint32_t(parser.scratch.size() - base),
+                token, begin, end};
+
+    // Bracket matches are relative to a token array, nodes don't keep them.
+    if (token.type <= Token::Type::close_brace) node.token.symbol = Token::no_match;
+
+    for (size_t i = base; i < parser.scratch.size(); ++i) tree.children.push(parser.scratch[i]);
+    parser.scratch.resize(base);
+    return tree.nodes.push(node);
+}
+
+// Reports tok as unexpected, unless already recovering from an error, and starts recovering.
+template<class Source>
+static void unexpected(Parser<Source>& parser, const Token& tok) {
+    if (!parser.recovering) {
+        if (tok.type == Token::Type::eof) {
+            parser.diagnostics.error(Diagnostic::syntax, "Unexpected end of file.", tok.offset);
+        } else if (tok.type == Token::Type::oper || tok.type == Token::Type::colon) {
+            parser.diagnostics.error(Diagnostic::syntax,
+                                     std::string("Unexpected '") + operator_spellings[tok.symbol] +
+                                     "'.", tok.offset);
+        } else {
+            parser.diagnostics.error(Diagnostic::syntax,
+                                     "Unexpected '" + Token::type_names.at(tok.type) + "'.",
+                                     tok.offset);
+        }
+    }
+
+    parser.recovering = true;
+}
+
+// Skips the rest of the statement after an error, up to the next newline or the brace closing
+// the block. Recovery ends there, unless the end of the file was reached.
+template<class Source>
+static void synchronize(Parser<Source>& parser) {
+    Source& lexer = parser.lexer;
+
+    size_t depth = 0;
+    while (true) {
+        Token::Type type = lexer.peek_token().type;
+        if (type == Token::Type::eof) return;
+        if (type == Token::Type::newline) break;
+        if (type == Token::Type::close_brace) {
+            if (!depth) break;
+            --depth;
+        }
+
+        if (type == Token::Type::open_brace) ++depth;
+        lexer.consume();
+    }
+
+    parser.recovering = false;
+}
+
+static bool is_trivia(const Token& tok) {
+    return tok.type == Token::Type::newline || tok.type == Token::Type::comment;
+}
+
+// Skips comments, and newlines too if they don't matter.
+template<class Source>
+static void skip_trivia(Parser<Source>& parser, bool newlines) {
+    while (true) {
+        Token::Type type = parser.lexer.peek_token().type;
+        if (type != Token::Type::comment && (type != Token::Type::newline || !newlines)) break;
+        parser.lexer.consume();
+    }
+}
+
+template<class Source>
+static uint32_t make_atom(Parser<Source>& parser, const Token& tok) {
+    return make_node(parser, AST::Type::atom, tok, tok.offset, tok.offset + tok.length,
+                     parser.scratch.size());
+}
+
+// Whether frame is a parenthesis or square bracket rather than a block, in which newlines don't
+// end expressions.
+static bool is_group(const Frame& frame) {
+    return frame.open.type == Token::Type::open_paren ||
+           frame.open.type == Token::Type::open_square;
+}
+
+// Whether tok can't start an operand, and so ends an expression that needs one.
+static bool ends_expression(const Token& tok) {
+    switch (tok.type) {
+    case Token::Type::newline:
+    case Token::Type::eof:
+    case Token::Type::comma:
+    case Token::Type::close_paren:
+    case Token::Type::close_square:
+    case Token::Type::close_brace:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+// Skips everything up to and including the bracket closing open, which was just consumed. This
+// only counts brackets, so it takes constant memory however deep they are nested.
+static void skip_bracket(Lexer& lexer, const Token&) {
+    for (size_t depth = 1; depth; ) {
+        switch (lexer.consume().type) {
+        case Token::Type::open_paren:
+        case Token::Type::open_square:
+        case Token::Type::open_brace:
+            ++depth;
+            break;
+        case Token::Type::close_paren:
+        case Token::Type::close_square:
+        case Token::Type::close_brace:
+            --depth;
+            break;
+        case Token::Type::eof:
+            return;
+        default:
+            break;
+        }
+    }
+}
+
+// Token arrays have their brackets matched, so this jumps straight past the match. Brackets match
+// the same way as they are counted above.
+static void skip_bracket(TokenCursor& tokens, const Token& open) {
+    tokens.skip(open.symbol == Token::no_match ? ~size_t(0) : open.symbol);
+}
+
+// Whether a bracket opened now would be nested more than max_depth deep.
+template<class Source>
+static bool too_deep(const Parser<Source>& parser) {
+    return !parser.frames.empty() && parser.depth + parser.frames.size() > parser.max_depth;
+}
+
+// Pushes a frame for the bracket open, which directly follows callee unless that is no_node,
+// and returns the state to parse its contents in. If that would nest brackets too deep, this
+// reports it and skips past the matching closing bracket instead, returning nested.
+template<class Source>
+static State open_frame(Parser<Source>& parser, const Token& open, uint32_t callee,
+                        State nested) {
+    if (too_deep(parser)) {
+        if (!parser.recovering) {
+            parser.diagnostics.error(Diagnostic::syntax, "Brackets are nested more than " +
+                                     std::to_string(parser.max_depth) + " deep.", open.offset);
+        }
+
+        parser.recovering = true;
+        skip_bracket(parser.lexer, open);
+        return nested;
+    }
+
+    Frame frame;
+    frame.open = open;
+    frame.callee = callee;
+    frame.base = parser.scratch.size();
+    frame.end = open.offset + open.length;
+    parser.frames.push_back(frame);
+    return is_group(frame) ? State::group : State::block;
+}
+
+// In a lazy parse, skips the block opened by open, the brace just consumed, and returns an
+// unparsed node for it. Blocks that aren't closed by a matching brace, or are nested too deep, are
+// parsed after all so their errors are reported, and this returns no_node for them.
+static uint32_t skip_block(Parser<Lexer>&, const Token&) {
+    return no_node;
+}
+
+static uint32_t skip_block(Parser<TokenCursor>& parser, const Token& open) {
+    TokenCursor& tokens = parser.lexer;
+    if (!parser.lazy || open.symbol == Token::no_match || too_deep(parser)) return no_node;
+
+    const Token& close = tokens.peek_token(open.symbol);
+    if (close.type != Token::Type::close_brace) return no_node;
+
+    AST node = {AST::Type::unparsed, uint32_t(tokens.position() - 1 - parser.lazy), 0, open,
+                open.offset, close.offset + close.length};
+    node.token.symbol = uint32_t(parser.depth + parser.frames.size());
+    tokens.skip(open.symbol);
+    return parser.tree.nodes.push(node);
+}
+
+// Pops the frame of the bracket whose node is node, and returns the operand it makes: node
+// itself, or the call or index of the callee it follows.
+template<class Source>
+static uint32_t close_frame(Parser<Source>& parser, uint32_t node) {
+    Frame frame = parser.frames.back();
+    parser.frames.pop_back();
+    if (frame.callee == no_node) return node;
+
+    AST::Type type = frame.open.type == Token::Type::open_paren ? AST::Type::call
+                                                                 : AST::Type::index;
+    size_t begin = parser.tree.nodes[frame.callee].begin;
+    size_t end = parser.tree.nodes[node].end;
+    size_t base = parser.scratch.size();
+    parser.scratch.push_back(frame.callee);
+    parser.scratch.push_back(node);
+    return make_node(parser, type, frame.open, begin, end, base);
+}
+
+// Finishes the statement of the innermost block as one of its children.
+template<class Source>
+static void end_statement(Parser<Source>& parser) {
+    const Frame& frame = parser.frames.back();
+    uint32_t statement = make_node(parser, AST::Type::expression, frame.first, frame.first.offset,
+                                   frame.statement_end, frame.statement_base);
+    parser.scratch.push_back(statement);
+}
+
+// Starts an expression in the innermost frame.
+template<class Source>
+static State begin_expression(Parser<Source>& parser) {
+    Frame& frame = parser.frames.back();
+    frame.operators_base = parser.operators.size();
+    frame.operands_base = parser.operands.size();
+    return State::operand;
+}
+
+// Adds node, an expression or comma, to the statement or group of the innermost frame, and
+// returns the state to continue it in. Errors are no_node and aren't added.
+template<class Source>
+static State add_child(Parser<Source>& parser, uint32_t node) {
+    Frame& frame = parser.frames.back();
+    bool group = is_group(frame);
+    if (node != no_node) {
+        parser.scratch.push_back(node);
+        size_t end = parser.tree.nodes[node].end;
+        if (group) frame.end = end;
+        else frame.statement_end = end;
+    }
+
+    return group ? State::group : State::statement;
+}
+
+// Combines the operator on top of the stack with its operands into a node.
+template<class Source>
+static void reduce(Parser<Source>& parser) {
+    PendingOperator op = parser.operators.back();
+    parser.operators.pop_back();
+
+    std::vector<uint32_t>& operands = parser.operands;
+    size_t count = op.prefix ? 1 : 2;
+    size_t begin = op.prefix ? op.token.offset
+                             : parser.tree.nodes[operands[operands.size() - 2]].begin;
+    size_t end = parser.tree.nodes[operands.back()].end;
+
+    size_t base = parser.scratch.size();
+    parser.scratch.insert(parser.scratch.end(), operands.end() - count, operands.end());
+    operands.resize(operands.size() - count);
+    operands.push_back(make_node(parser, op.prefix ? AST::Type::unary : AST::Type::binary,
+                                 op.token, begin, end, base));
+}
+
+// Finishes the expression of the innermost frame by reducing its remaining operators, and adds
+// it to the statement or group.
+template<class Source>
+static State end_expression(Parser<Source>& parser) {
+    const Frame& frame = parser.frames.back();
+    while (parser.operators.size() > frame.operators_base) reduce(parser);
+
+    uint32_t expression = no_node;
+    if (parser.operands.size() > frame.operands_base) {
+        expression = parser.operands.back();
+        parser.operands.pop_back();
+    }
+
+    return add_child(parser, expression);
+}
+
+
+// Parses statements up to and including the closing brace, or up to eof for the root block.
+//
+// Rather than recursing into nested brackets, which could overflow the call stack on deep input,
+// this is a single loop over the states of the innermost bracket, and brackets push frames on a
+// stack of their own. Operators work alike: they wait on a stack until an operator that binds
+// less tightly, or the end of the expression, completes their right operand. Closing a bracket
+// pops its frame and continues with its node as an operand of the enclosing expression.
+template<class Source>
+static uint32_t parse_block(Parser<Source>& parser, const Token& open) {
+    Source& lexer = parser.lexer;
+    std::vector<Frame>& frames = parser.frames;
+
+    State state = open_frame(parser, open, no_node, State::block);
+    uint32_t operand = no_node;
+    while (true) {
+        switch (state) {
+        case State::block: {
+            while (is_trivia(lexer.peek_token())) lexer.consume();
+
+            Frame& frame = frames.back();
+            bool root = frame.open.type != Token::Type::open_brace;
+            const Token& tok = lexer.peek_token();
+            if (tok.type == Token::Type::close_brace && root) {
+                unexpected(parser, tok);
+                lexer.consume();
+                synchronize(parser);
+                break;
+            }
+
+            if (tok.type != Token::Type::eof && tok.type != Token::Type::close_brace) {
+                frame.first = tok;
+                frame.statement_base = parser.scratch.size();
+                frame.statement_end = tok.offset;
+                state = State::statement;
+                break;
+            }
+
+            Token end = lexer.consume();
+            uint32_t block;
+            if (root) {
+                block = make_node(parser, AST::Type::block, end, 0, end.offset, frame.base);
+            } else if (end.type == Token::Type::eof) {
+                // Without its closing brace, the block ends at the end of the file.
+                unexpected(parser, end);
+                block = make_node(parser, AST::Type::block, frame.open, frame.open.offset,
+                                  end.offset, frame.base);
+            } else {
+                block = make_node(parser, AST::Type::block, frame.open, frame.open.offset,
+                                  end.offset + end.length, frame.base);
+            }
+
+            if (frames.size() == 1) {
+                frames.pop_back();
+                return block;
+            }
+
+            operand = close_frame(parser, block);
+            state = State::postfix;
+            break;
+        }
+
+        // Expressions that follow each other without an operator in between are separate
+        // children of the statement, as are the commas between them.
+        case State::statement: {
+            // After an error, the statement ends at the next newline or closing brace.
+            if (parser.recovering) synchronize(parser);
+
+            const Token& tok = lexer.peek_token();
+            if (tok.type == Token::Type::newline || tok.type == Token::Type::eof ||
+                tok.type == Token::Type::close_brace) {
+                end_statement(parser);
+                state = State::block;
+            } else if (tok.type == Token::Type::comment) {
+                lexer.consume();
+            } else if (tok.type == Token::Type::comma) {
+                state = add_child(parser, make_atom(parser, lexer.consume()));
+            } else {
+                state = begin_expression(parser);
+            }
+
+            break;
+        }
+
+        // Groups may span multiple lines.
+        case State::group: {
+            Frame& frame = frames.back();
+            if (!parser.recovering) {
+                while (is_trivia(lexer.peek_token())) lexer.consume();
+
+                const Token& tok = lexer.peek_token();
+                Token::Type close = frame.open.type == Token::Type::open_paren
+                                  ? Token::Type::close_paren : Token::Type::close_square;
+                if (tok.type == close) {
+                    frame.end = tok.offset + tok.length;
+                    lexer.consume();
+                } else if (tok.type == Token::Type::close_paren ||
+                           tok.type == Token::Type::close_square ||
+                           tok.type == Token::Type::close_brace || tok.type == Token::Type::eof) {
+                    // Any other closing bracket ends the group early, and the statement with it.
+                    unexpected(parser, tok);
+                } else if (tok.type == Token::Type::comma) {
+                    state = add_child(parser, make_atom(parser, lexer.consume()));
+                    break;
+                } else {
+                    state = begin_expression(parser);
+                    break;
+                }
+            }
+
+            uint32_t group = make_node(parser, AST::Type::group, frame.open, frame.open.offset,
+                                       frame.end, frame.base);
+            operand = close_frame(parser, group);
+            state = State::postfix;
+            break;
+        }
+
+        case State::operand: {
+            while (lexer.peek_token().type == Token::Type::oper &&
+                   (lexer.peek_token().symbol == op_add ||
+                    lexer.peek_token().symbol == op_subtract)) {
+                parser.operators.push_back({lexer.consume(), prefix_level, true});
+            }
+
+            size_t operators_base = frames.back().operators_base;
+            const Token& tok = lexer.peek_token();
+            if (parser.operators.size() > operators_base && ends_expression(tok)) {
+                if (!parser.recovering) {
+                    Operator op = Operator(parser.operators.back().token.symbol);
+                    parser.diagnostics.error(Diagnostic::syntax,
+                                             std::string("Expected an expression after '") +
+                                             operator_spellings[op] + "'.", tok.offset);
+                }
+
+                parser.recovering = true;
+            } else {
+                Token primary = lexer.consume();
+                switch (primary.type) {
+                case Token::Type::open_brace:
+                    operand = skip_block(parser, primary);
+                    state = operand != no_node ? State::postfix
+                                               : open_frame(parser, primary, no_node,
+                                                            State::operand);
+                    break;
+                case Token::Type::open_paren:
+                case Token::Type::open_square:
+                    state = open_frame(parser, primary, no_node, State::operand);
+                    break;
+                case Token::Type::close_paren:
+                case Token::Type::close_square:
+                case Token::Type::close_brace:
+                case Token::Type::eof:
+                case Token::Type::colon:
+                case Token::Type::period:
+                case Token::Type::oper:
+                    unexpected(parser, primary);
+                    break;
+                default:
+                    operand = make_atom(parser, primary);
+                    state = State::postfix;
+                    break;
+                }
+
+                if (state != State::operand) break;
+            }
+
+            // Operators left without an operand are dropped, the rest still make a node.
+            while (parser.operators.size() > operators_base && parser.operators.back().prefix) {
+                parser.operators.pop_back();
+            }
+
+            if (parser.operators.size() > operators_base) parser.operators.pop_back();
+            state = end_expression(parser);
+            break;
+        }
+
+        // Calls, indexing and member accesses only count if their bracket or period directly
+        // follows the operand, f (x) are two expressions.
+        case State::postfix: {
+            state = State::operators;
+            if (parser.recovering) break;
+
+            const Token& next = lexer.peek_token();
+            size_t begin = parser.tree.nodes[operand].begin;
+            if (next.offset != parser.tree.nodes[operand].end) break;
+
+            if (next.type == Token::Type::open_paren || next.type == Token::Type::open_square) {
+                Token open = lexer.consume();
+                state = open_frame(parser, open, operand, State::operators);
+            } else if (next.type == Token::Type::period) {
+                Token period = lexer.consume();
+                Token name = lexer.peek_token();
+                if (name.type != Token::Type::identifier) {
+                    unexpected(parser, name);
+                    break;
+                }
+
+                lexer.consume();
+                size_t base = parser.scratch.size();
+                parser.scratch.push_back(operand);
+                parser.scratch.push_back(make_atom(parser, name));
+                operand = make_node(parser, AST::Type::member, period, begin,
+                                    name.offset + name.length, base);
+                state = State::postfix;
+            }
+
+            break;
+        }
+
+        case State::operators: {
+            parser.operands.push_back(operand);
+            state = State::operand;
+            if (!parser.recovering) {
+                skip_trivia(parser, is_group(frames.back()));
+                const Token& next = lexer.peek_token();
+                if (next.type == Token::Type::oper || next.type == Token::Type::colon) {
+                    Precedence precedence = precedences[next.symbol];
+                    size_t operators_base = frames.back().operators_base;
+                    while (parser.operators.size() > operators_base) {
+                        const PendingOperator& top = parser.operators.back();
+                        if (top.level < precedence.level ||
+                            (top.level == precedence.level && precedence.right)) break;
+
+                        reduce(parser);
+                    }
+
+                    parser.operators.push_back({lexer.consume(), precedence.level, false});
+
+                    // An expression continues on the next line after an operator.
+                    skip_trivia(parser, true);
+                    break;
+                }
+            }
+
+            state = end_expression(parser);
+            break;
+        }
+        }
+    }
+}
+
+
+template<class Source>
+static Tree parse_source(Source& source, Diagnostics& diagnostics, size_t max_depth,
+                         const Token* lazy = nullptr) {
+    Tree tree;
+    Parser<Source> parser(source, tree, diagnostics, max_depth, 0, lazy);
+
+    Token root = {0, 0, SymbolTable::no_symbol, Token::Type::eof};
+    tree.root = parse_block(parser, root);
+    return tree;
 }
 
 
 namespace p {
-    std::shared_ptr<AST> compile(u32str::iterator begin, u32str::iterator end) {
-        Lexer lexer(begin, end);
-        return parse(lexer);
+    Tree parse(Lexer& lexer, Diagnostics& diagnostics, size_t max_depth) {
+        return parse_source(lexer, diagnostics, max_depth);
+    }
+
+    Tree parse(TokenCursor& tokens, Diagnostics& diagnostics, size_t max_depth) {
+        return parse_source(tokens, diagnostics, max_depth);
+    }
+
+    uint32_t reparse_block(Tree& tree, TokenCursor& tokens, const Token& open, size_t depth,
+                           size_t max_depth, Diagnostics& diagnostics) {
+        Parser<TokenCursor> parser(tokens, tree, diagnostics, max_depth, depth, nullptr);
+        return ::parse_block(parser, open);
+    }
+
+    Tree parse_lazy(const std::vector<Token>& tokens, Diagnostics& diagnostics,
+                    size_t max_depth) {
+        TokenCursor cursor(tokens.data(), tokens.data() + tokens.size());
+        return parse_source(cursor, diagnostics, max_depth, tokens.data());
+    }
+
+    const AST& expand_block(Tree& tree, uint32_t index, const std::vector<Token>& tokens,
+                            Diagnostics& diagnostics, size_t max_depth) {
+        AST node = tree.nodes[index];
+        if (node.type != AST::Type::unparsed) return tree.nodes[index];
+
+        // The statements are parsed like a root block that ends at the closing brace, so braces
+        // that don't match in between are errors rather than the end of the block.
+        const Token* open = tokens.data() + node.first_child;
+        const Token* close = open + open->symbol;
+        Token end = {close->offset, 0, SymbolTable::no_symbol, Token::Type::eof};
+        TokenCursor cursor(open + 1, close, end);
+        Parser<TokenCursor> parser(cursor, tree, diagnostics, max_depth, node.token.symbol,
+                                   tokens.data());
+        uint32_t block = ::parse_block(parser, end);
+
+        // Like reparse, this overwrites the node in place, which links the block into its parent.
+        AST& result = tree.nodes[index];
+        result = tree.nodes[block];
+        result.token = node.token;
+        result.token.symbol = Token::no_match;
+        result.begin = node.begin;
+        result.end = node.end;
+        return result;
+    }
+
+    Tree compile(const uint8_t* begin, const uint8_t* end, SymbolTable& symbols,
+                 Diagnostics& diagnostics, TokenCounts* counts, size_t max_depth) {
+        // The parser pulls tokens from the lexer as it goes, so the two can't be timed apart.
+        TraceScope trace("lex and parse");
+        Lexer lexer(begin, end, symbols, diagnostics);
+        Tree tree = parse(lexer, diagnostics, max_depth);
+        if (counts) {
+            for (size_t i = 0; i < Token::num_types; ++i) (*counts)[i] += lexer.token_counts()[i];
+        }
+        return tree;
+    }
+
+    Tree compile(const uint8_t* begin, const uint8_t* end, SymbolTable& symbols,
+                 Diagnostics& diagnostics, ThreadPool& pool, TokenCounts* counts,
+                 size_t max_depth) {
+        std::vector<Token> tokens;
+        {
+            TraceScope trace("lex");
+            tokens = lex_parallel(begin, end, symbols, diagnostics, pool);
+        }
+
+        if (counts) {
+            for (const Token& tok : tokens) ++(*counts)[tok.type];
+        }
+
+        TraceScope trace("parse");
+        TokenCursor cursor(tokens.data(), tokens.data() + tokens.size());
+        return parse(cursor, diagnostics, max_depth);
     }
 }
@@ -1,12 +1,58 @@
 #ifndef P_PARSE_H
 #define P_PARSE_H
 
+#include <vector>
+
 #include "ast.h"
+#include "diagnostic.h"
+#include "intern.h"
 #include "lexer.h"
+#include "thread_pool.h"
 
 namespace p {
-    AST parse(Lexer& lexer);
-    AST compile(u32str::iterator begin, u32str::iterator end);
+    // How deep brackets may be nested by default. The parser keeps its own stack on the heap
+    // rather than recursing, so this bounds its memory, not the depth of the call stack.
+    const size_t default_max_depth = 100000;
+
+    // Parses a whole source. Syntax errors are recorded in diagnostics, after which parsing
+    // resumes at the next statement, so there always is a tree. Brackets nested more than
+    // max_depth deep are an error too, their contents are skipped.
+    Tree parse(Lexer& lexer, Diagnostics& diagnostics, size_t max_depth = default_max_depth);
+    Tree parse(TokenCursor& tokens, Diagnostics& diagnostics,
+               size_t max_depth = default_max_depth);
+
+    // Parses tokens, which must have matched brackets, like parse but without looking into
+    // brace blocks: each is skipped in constant time and left as an unparsed node spanning it,
+    // until expand_block parses it. So only errors outside of blocks are found, check_brackets
+    // finds the bracket errors in all of them. A block ends at the brace match_brackets paired
+    // with its opening one, so where brackets are mismatched the blocks, and the tree once they
+    // are all expanded, can differ from those of parse. The tree can't be reparsed
+    // incrementally.
+    Tree parse_lazy(const std::vector<Token>& tokens, Diagnostics& diagnostics,
+                    size_t max_depth = default_max_depth);
+
+    // Parses the statements of the node at index if it is unparsed, making it an ordinary block
+    // in place, whose nested blocks are unparsed in turn. tokens are the ones the tree was
+    // parsed from. Returns the node, which is left as it is if it was parsed already.
+    const AST& expand_block(Tree& tree, uint32_t index, const std::vector<Token>& tokens,
+                            Diagnostics& diagnostics, size_t max_depth = default_max_depth);
+
+    // Parses the block opened by open, the contents of which are next in tokens, appending its
+    // nodes to tree. The block is nested depth deep in the whole source, counting itself.
+    // Returns the index of the block node.
+    uint32_t reparse_block(Tree& tree, TokenCursor& tokens, const Token& open, size_t depth,
+                           size_t max_depth, Diagnostics& diagnostics);
+
+    // Lexes and parses [begin, end). If counts is given, the number of tokens of each type, the
+    // eof at the end being one, is added to it.
+    Tree compile(const uint8_t* begin, const uint8_t* end, SymbolTable& symbols,
+                 Diagnostics& diagnostics, TokenCounts* counts = nullptr,
+                 size_t max_depth = default_max_depth);
+
+    // Compiles a big file, lexing it in parallel on pool. symbols must be thread-safe.
+    Tree compile(const uint8_t* begin, const uint8_t* end, SymbolTable& symbols,
+                 Diagnostics& diagnostics, ThreadPool& pool, TokenCounts* counts = nullptr,
+                 size_t max_depth = default_max_depth);
 }
 
 #endif
@@ -0,0 +1,201 @@
+#include <cstring>
+
+#include "serialize.h"
+
+
+namespace p {
+    static const char unit_magic[8] = {'p', '-', 'u', 'n', 'i', 't', '\0', '\0'};
+    static const uint32_t byte_order_mark = 0x01020304;
+
+    static_assert(sizeof(UnitToken) == 24, "UnitToken has padding");
+    static_assert(sizeof(UnitNode) == 56, "UnitNode has padding");
+    static_assert(sizeof(UnitString) == 16, "UnitString has padding");
+    static_assert(sizeof(UnitDiagnostic) == 16, "UnitDiagnostic has padding");
+    static_assert(sizeof(UnitHeader) % 8 == 0, "UnitHeader must keep sections aligned");
+
+
+    static UnitToken unit_token(const Token& tok) {
+        UnitToken result;
+        std::memset(&result, 0, sizeof(result));
+        result.offset = tok.offset;
+        result.length = tok.length;
+        result.symbol = tok.symbol;
+        result.type = tok.type;
+        return result;
+    }
+
+    static UnitNode unit_node(const AST& node) {
+        UnitNode result;
+        std::memset(&result, 0, sizeof(result));
+        result.type = node.type;
+        result.first_child = node.first_child;
+        result.num_children = node.num_children;
+        result.begin = node.begin;
+        result.end = node.end;
+        result.token = unit_token(node.token);
+        return result;
+    }
+
+
+    std::string serialize(const UnitContents& contents) {
+        UnitHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, unit_magic, sizeof(unit_magic));
+        header.version = unit_format_version;
+        header.byte_order = byte_order_mark;
+        header.source_size = contents.source_size;
+        header.source_hash = contents.source_hash;
+        header.root = contents.tree ? contents.tree->root : 0;
+        header.num_symbols = contents.symbols->size();
+
+        std::string out(sizeof(header), '\0');
+        UnitHeader::Section current = UnitHeader::tokens;
+        auto begin_section = [&](UnitHeader::Section section) {
+            out.resize((out.size() + 7) & ~size_t(7));
+            header.sections[section].offset = out.size();
+            current = section;
+        };
+        auto append = [&](const void* bytes, size_t size) {
+            out.append(static_cast<const char*>(bytes), size);
+            header.sections[current].size += size;
+        };
+
+        begin_section(UnitHeader::tokens);
+        if (contents.tokens) {
+            for (const Token& tok : *contents.tokens) {
+                UnitToken record = unit_token(tok);
+                append(&record, sizeof(record));
+            }
+        }
+
+        begin_section(UnitHeader::nodes);
+        if (contents.tree) {
+            for (uint32_t i = 0; i < contents.tree->nodes.size(); ++i) {
+                UnitNode record = unit_node(contents.tree->nodes[i]);
+                append(&record, sizeof(record));
+            }
+        }
+
+        begin_section(UnitHeader::children);
+        if (contents.tree) {
+            for (uint32_t i = 0; i < contents.tree->children.size(); ++i) {
+                append(&contents.tree->children[i], sizeof(uint32_t));
+            }
+        }
+
+        // The strings are gathered first, their data goes after the table.
+        std::string data;
+        std::vector<UnitString> strings;
+        auto add_string = [&](const void* bytes, size_t size) {
+            UnitString record;
+            std::memset(&record, 0, sizeof(record));
+            record.offset = data.size();
+            record.length = size;
+            strings.push_back(record);
+            data.append(static_cast<const char*>(bytes), size);
+            return uint32_t(strings.size() - 1);
+        };
+
+        for (uint32_t i = 0; i < contents.symbols->size(); ++i) {
+            Spelling spelling = contents.symbols->spelling(i);
+            add_string(spelling.data, spelling.length);
+        }
+
+        std::vector<UnitDiagnostic> diagnostics;
+        if (contents.diagnostics) {
+            for (const Diagnostic& diagnostic : *contents.diagnostics) {
+                UnitDiagnostic record;
+                record.offset = diagnostic.offset;
+                record.kind = diagnostic.kind;
+                record.message = add_string(diagnostic.message.data(), diagnostic.message.size());
+                diagnostics.push_back(record);
+            }
+        }
+
+        begin_section(UnitHeader::strings);
+        append(strings.data(), strings.size() * sizeof(UnitString));
+        begin_section(UnitHeader::string_data);
+        append(data.data(), data.size());
+        begin_section(UnitHeader::diagnostics);
+        append(diagnostics.data(), diagnostics.size() * sizeof(UnitDiagnostic));
+
+        std::memcpy(&out[0], &header, sizeof(header));
+        return out;
+    }
+
+
+    bool UnitView::open(const uint8_t* data, size_t size) {
+        this->data = data;
+        header = nullptr;
+
+        auto h = reinterpret_cast<const UnitHeader*>(data);
+        if (size < sizeof(UnitHeader) || reinterpret_cast<uintptr_t>(data) % 8 ||
+            std::memcmp(h->magic, unit_magic, sizeof(unit_magic)) != 0 ||
+            h->version != unit_format_version || h->byte_order != byte_order_mark) {
+            return false;
+        }
+
+        const size_t record_sizes[UnitHeader::num_sections] = {
+            sizeof(UnitToken), sizeof(UnitNode), sizeof(uint32_t), sizeof(UnitString), 1,
+            sizeof(UnitDiagnostic)
+        };
+
+        for (int i = 0; i < UnitHeader::num_sections; ++i) {
+            auto& section = h->sections[i];
+            if (section.offset % 8 || section.offset > size ||
+                section.size > size - section.offset || section.size % record_sizes[i]) {
+                return false;
+            }
+        }
+
+        // From here on the sections can be read, check that the indices in them are in bounds.
+        header = h;
+        bool ok = !num_nodes() || header->root < num_nodes();
+
+        for (size_t i = 0; ok && i < num_nodes(); ++i) {
+            const UnitNode& node = nodes()[i];
+            ok = node.first_child <= num_children() &&
+                 node.num_children <= num_children() - node.first_child;
+        }
+
+        for (size_t i = 0; ok && i < num_children(); ++i) ok = children()[i] < num_nodes();
+
+        const UnitString* strings = section<UnitString>(UnitHeader::strings);
+        uint64_t data_size = header->sections[UnitHeader::string_data].size;
+        ok &= num_symbols() <= num_strings();
+        for (size_t i = 0; ok && i < num_strings(); ++i) {
+            ok = strings[i].offset <= data_size &&
+                 strings[i].length <= data_size - strings[i].offset;
+        }
+
+        const UnitDiagnostic* records = section<UnitDiagnostic>(UnitHeader::diagnostics);
+        for (size_t i = 0; ok && i < num_diagnostics(); ++i) {
+            ok = records[i].message < num_strings();
+        }
+
+        if (!ok) header = nullptr;
+        return ok;
+    }
+
+
+    Spelling UnitView::string(uint32_t index) const {
+        if (index >= num_strings()) return {nullptr, 0};
+
+        const UnitString& record = section<UnitString>(UnitHeader::strings)[index];
+        return {section<uint8_t>(UnitHeader::string_data) + record.offset, record.length};
+    }
+
+
+    Diagnostics UnitView::diagnostics() const {
+        Diagnostics result;
+        const UnitDiagnostic* records = section<UnitDiagnostic>(UnitHeader::diagnostics);
+        for (size_t i = 0; i < num_diagnostics(); ++i) {
+            Spelling message = string(records[i].message);
+            result.error(Diagnostic::Kind(records[i].kind),
+                         std::string(message.data, message.data + message.length),
+                         records[i].offset);
+        }
+
+        return result;
+    }
+}
@@ -0,0 +1,150 @@
+#ifndef P_SERIALIZE_H
+#define P_SERIALIZE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "diagnostic.h"
+#include "intern.h"
+#include "lexer.h"
+
+
+// Binary format for the results of compiling a source, a "unit": its tokens, syntax tree,
+// interned strings and diagnostics. A unit is a header followed by flat arrays of fixed-size
+// records, which refer to each other by index and to the source by byte offset, so a file can be
+// mapped into memory anywhere and read in place.
+//
+// Records are written in the byte order of the writer, which the header records, and every
+// section starts at a multiple of 8 bytes. The version is bumped on any change to the layout.
+namespace p {
+    const uint32_t unit_format_version = 3;
+
+    struct UnitToken {
+        uint64_t offset;  // Byte offset in the source.
+        uint32_t length;
+        uint32_t symbol;  // Index in the string table, for identifiers and number suffixes.
+                          // The Operator of oper and colon tokens. The distance in tokens to
+                          // the matching bracket of brackets, see match_brackets.
+        uint8_t type;     // Token::Type
+        uint8_t reserved[7];
+    };
+
+    struct UnitNode {
+        uint8_t type;     // AST::Type
+        uint8_t reserved[3];
+        uint32_t first_child; // Index of the first child in the children section.
+        uint32_t num_children;
+        uint32_t reserved2;
+        uint64_t begin;   // Byte range in the source spanned by the node.
+        uint64_t end;
+        UnitToken token;  // The first token of the node.
+    };
+
+    struct UnitString {
+        uint64_t offset;  // In the string data section.
+        uint32_t length;
+        uint32_t reserved;
+    };
+
+    struct UnitDiagnostic {
+        uint64_t offset;  // Byte offset in the source.
+        uint32_t kind;    // Diagnostic::Kind
+        uint32_t message; // Index in the string table.
+    };
+
+    struct UnitHeader {
+        enum Section {
+            tokens,       // UnitToken[]
+            nodes,        // UnitNode[]
+            children,     // uint32_t[], node indices
+            strings,      // UnitString[], symbol spellings followed by diagnostic messages
+            string_data,  // The bytes of all strings.
+            diagnostics,  // UnitDiagnostic[]
+            num_sections
+        };
+
+        char magic[8];         // "p-unit" padded with zeros.
+        uint32_t version;
+        uint32_t byte_order;   // 0x01020304 as written.
+        uint64_t source_size;
+        uint64_t source_hash;  // Chosen by the writer, e.g. a cache key.
+        uint32_t root;         // Index of the root node, if there are nodes.
+        uint32_t num_symbols;  // The first num_symbols strings are spellings of symbols.
+        struct {
+            uint64_t offset;   // From the start of the unit.
+            uint64_t size;     // In bytes.
+        } sections[num_sections];
+    };
+
+
+    // What goes into a unit. Leaving out the tokens or the tree leaves their sections empty.
+    struct UnitContents {
+        const std::vector<Token>* tokens;
+        const Tree* tree;
+        const SymbolTable* symbols;
+        const Diagnostics* diagnostics;
+        size_t source_size;
+        uint64_t source_hash;
+    };
+
+    // Returns the unit of contents.
+    std::string serialize(const UnitContents& contents);
+
+
+    // Read-only view of a unit in memory, which is only checked once when opened. The memory
+    // must stay alive and in place as long as the view is used.
+    class UnitView {
+    public:
+        UnitView() : data(nullptr), header(nullptr) { }
+
+        // Makes this a view of [data, data + size), which must be 8-byte aligned. Returns false,
+        // leaving the view invalid, if that isn't an intact unit of this version and byte order,
+        // whose nodes only refer to nodes and children within it.
+        bool open(const uint8_t* data, size_t size);
+
+        bool valid() const { return header != nullptr; }
+
+        uint64_t source_size() const { return header->source_size; }
+        uint64_t source_hash() const { return header->source_hash; }
+
+        const UnitToken* tokens() const { return section<UnitToken>(UnitHeader::tokens); }
+        size_t num_tokens() const { return count<UnitToken>(UnitHeader::tokens); }
+
+        const UnitNode* nodes() const { return section<UnitNode>(UnitHeader::nodes); }
+        size_t num_nodes() const { return count<UnitNode>(UnitHeader::nodes); }
+        const UnitNode& root() const { return nodes()[header->root]; }
+        const UnitNode& child(const UnitNode& node, uint32_t i) const {
+            return nodes()[children()[node.first_child + i]];
+        }
+
+        const uint32_t* children() const { return section<uint32_t>(UnitHeader::children); }
+        size_t num_children() const { return count<uint32_t>(UnitHeader::children); }
+
+        size_t num_symbols() const { return header->num_symbols; }
+        size_t num_strings() const { return count<UnitString>(UnitHeader::strings); }
+
+        // The string at index, or an empty one if there is none (e.g. for the symbol of a token
+        // that doesn't have one).
+        Spelling string(uint32_t index) const;
+
+        size_t num_diagnostics() const { return count<UnitDiagnostic>(UnitHeader::diagnostics); }
+        Diagnostics diagnostics() const;
+
+    private:
+        template<class T>
+        const T* section(UnitHeader::Section s) const {
+            return reinterpret_cast<const T*>(data + header->sections[s].offset);
+        }
+
+        template<class T>
+        size_t count(UnitHeader::Section s) const { return header->sections[s].size / sizeof(T); }
+
+        const uint8_t* data;
+        const UnitHeader* header;
+    };
+}
+
+#endif
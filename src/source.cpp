@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "exception.h"
+#include "source.h"
+
+
+namespace p {
+    SourceBuffer::SourceBuffer(SourceBuffer&& other)
+    : map(other.map), map_size(other.map_size), owned(std::move(other.owned)) {
+        other.map = nullptr;
+        other.map_size = 0;
+    }
+
+    SourceBuffer& SourceBuffer::operator=(SourceBuffer&& other) {
+        if (this != &other) {
+            release();
+            map = other.map;
+            map_size = other.map_size;
+            owned = std::move(other.owned);
+            other.map = nullptr;
+            other.map_size = 0;
+        }
+
+        return *this;
+    }
+
+    SourceBuffer::~SourceBuffer() {
+        release();
+    }
+
+    void SourceBuffer::release() {
+        if (map) munmap(map, map_size);
+        map = nullptr;
+        map_size = 0;
+    }
+
+
+    // Closes a file descriptor when going out of scope, unless it's stdin.
+    struct FdGuard {
+        int fd;
+        ~FdGuard() { if (fd != STDIN_FILENO) close(fd); }
+    };
+
+
+    // Reads everything from fd into an owned buffer, growing it geometrically. Used for inputs
+    // that can't be mapped. size_hint is used as the initial capacity if known.
+    static u8str read_stream(int fd, size_t size_hint) {
+        u8str result;
+        result.resize(size_hint > 4096 ? size_hint : 4096);
+
+        size_t len = 0;
+        while (true) {
+            if (len == result.size()) result.resize(2 * result.size());
+
+            ssize_t bytes_read = read(fd, &result[len], result.size() - len);
+            if (bytes_read < 0) {
+                if (errno == EINTR) continue;
+                throw FilesystemError(std::strerror(errno));
+            }
+
+            if (!bytes_read) break;
+            len += bytes_read;
+        }
+
+        result.resize(len);
+        return result;
+    }
+
+
+    int open_source(const char* filename) {
+        if (std::strcmp(filename, "-") == 0) return STDIN_FILENO;
+
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) throw FilesystemError(std::strerror(errno));
+        return fd;
+    }
+
+
+    SourceBuffer read_source(const char* filename) {
+        FdGuard guard = {open_source(filename)};
+        int fd = guard.fd;
+
+        struct stat st;
+        if (fstat(fd, &st) < 0) throw FilesystemError(std::strerror(errno));
+        if (S_ISDIR(st.st_mode)) throw FilesystemError(std::strerror(EISDIR));
+
+        // Empty files can't be mapped, and some regular files (e.g. in /proc) report size 0 but
+        // do have contents, so those go through the streaming path as well.
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+                SourceBuffer result;
+                result.map = map;
+                result.map_size = st.st_size;
+                return result;
+            }
+        }
+
+        size_t size_hint = S_ISREG(st.st_mode) ? st.st_size : 0;
+        return SourceBuffer(read_stream(fd, size_hint));
+    }
+
+
+    LineIndex::LineIndex(const uint8_t* data, size_t size) : data(data), size(size), starts(1, 0) {
+        starts.reserve(size / 32 + 1);
+
+        // A \r followed by \n doesn't start a line, the \n does.
+        auto add_break = [&](size_t i) {
+            if (data[i] == '\r' && i + 1 < size && data[i + 1] == '\n') return;
+            starts.push_back(i + 1);
+        };
+
+        size_t i = 0;
+#ifdef __SSE2__
+        const __m128i lf = _mm_set1_epi8('\n');
+        const __m128i cr = _mm_set1_epi8('\r');
+        for (; i + 16 <= size; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lf),
+                                                           _mm_cmpeq_epi8(v, cr)));
+            while (mask) {
+                add_break(i + __builtin_ctz(mask));
+                mask &= mask - 1;
+            }
+        }
+#endif
+
+        for (; i < size; ++i) {
+            if (data[i] == '\n' || data[i] == '\r') add_break(i);
+        }
+    }
+
+    LineIndex::Location LineIndex::locate(size_t offset) const {
+        size_t line = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin();
+
+        size_t col = 1;
+        for (size_t i = starts[line - 1]; i < offset && i < size; ++i) {
+            col += !is_continuation(data[i]);
+        }
+
+        return {line, col};
+    }
+
+    size_t LineIndex::line_end(size_t line) const {
+        if (line >= starts.size()) return size;
+
+        // Step back over the newline, which is one or two bytes.
+        size_t end = starts[line] - 1;
+        if (end > starts[line - 1] && data[end] == '\n' && data[end - 1] == '\r') --end;
+        return end;
+    }
+}
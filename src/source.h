@@ -0,0 +1,78 @@
+#ifndef P_SOURCE_H
+#define P_SOURCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+
+namespace p {
+    // Immutable view of the raw bytes of a source file. Regular files are memory-mapped and read
+    // in place, anything else (pipes, stdin, character devices) is streamed into an owned buffer.
+    class SourceBuffer {
+    public:
+        SourceBuffer() : map(nullptr), map_size(0) { }
+        explicit SourceBuffer(u8str bytes) : map(nullptr), map_size(0), owned(std::move(bytes)) { }
+        SourceBuffer(SourceBuffer&& other);
+        SourceBuffer& operator=(SourceBuffer&& other);
+        SourceBuffer(const SourceBuffer&) = delete;
+        SourceBuffer& operator=(const SourceBuffer&) = delete;
+        ~SourceBuffer();
+
+        const uint8_t* data() const {
+            return map ? static_cast<const uint8_t*>(map) : owned.data();
+        }
+        size_t size() const { return map ? map_size : owned.size(); }
+        const uint8_t* begin() const { return data(); }
+        const uint8_t* end() const { return data() + size(); }
+        bool mapped() const { return map != nullptr; }
+
+    private:
+        friend SourceBuffer read_source(const char* filename);
+
+        void release();
+
+        void* map;
+        size_t map_size;
+        u8str owned;
+    };
+
+    // Reads a file as binary data. The filename "-" reads from stdin.
+    SourceBuffer read_source(const char* filename);
+
+    // Opens a file for reading and returns its descriptor, "-" being stdin.
+    int open_source(const char* filename);
+
+
+    // Table of the offsets at which each line of a source starts, built once so that byte offsets
+    // can be turned into lines and columns by binary search. Newlines are \n, \r or \r\n, so this
+    // also works on sources that haven't been normalized yet.
+    class LineIndex {
+    public:
+        struct Location {
+            size_t line;
+            size_t col; // In code points.
+        };
+
+        LineIndex() : data(nullptr), size(0), starts(1, 0) { }
+        LineIndex(const uint8_t* data, size_t size);
+
+        // Lines and columns are 1-based. The source must still be alive.
+        Location locate(size_t offset) const;
+
+        size_t num_lines() const { return starts.size(); }
+        size_t line_begin(size_t line) const { return starts[line - 1]; }
+
+        // Offset of the newline ending the line, or the end of the source.
+        size_t line_end(size_t line) const;
+
+    private:
+        const uint8_t* data;
+        size_t size;
+        std::vector<size_t> starts;
+    };
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include <cstdlib>
+#include <new>
+
+#include <sys/resource.h>
+
+#include "stats.h"
+
+
+// Counted per thread, so that phases running on different threads don't count each other's
+// allocations and counting takes no synchronization. Scopes count into a shared counter on top.
+static thread_local size_t num_allocations = 0;
+static thread_local std::atomic<size_t>* scope_counter = nullptr;
+
+void* operator new(size_t size) {
+    ++num_allocations;
+    if (scope_counter) scope_counter->fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+
+namespace p {
+    Stats& Stats::operator+=(const Stats& other) {
+        files += other.files;
+        bytes_read += other.bytes_read;
+        code_points += other.code_points;
+        for (size_t i = 0; i < Token::num_types; ++i) tokens[i] += other.tokens[i];
+        ast_nodes += other.ast_nodes;
+        arena_bytes += other.arena_bytes;
+        symbols += other.symbols;
+        for (int i = 0; i < num_phases; ++i) allocations[i] += other.allocations[i];
+        return *this;
+    }
+
+
+    size_t allocation_count() {
+        return num_allocations;
+    }
+
+    AllocationScope::AllocationScope(std::atomic<size_t>* counter) : previous(scope_counter) {
+        scope_counter = counter;
+    }
+
+    AllocationScope::~AllocationScope() {
+        scope_counter = previous;
+    }
+
+    std::atomic<size_t>* allocation_counter() {
+        return scope_counter;
+    }
+
+    size_t peak_rss() {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+
+        // Linux reports kilobytes.
+        return size_t(usage.ru_maxrss) * 1024;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef P_STATS_H
+#define P_STATS_H
+
+#include <atomic>
+#include <cstddef>
+
+#include "lexer.h"
+
+
+namespace p {
+    // Counters gathered while compiling, summed over all files for --stats.
+    struct Stats {
+        enum Phase { read, decode, compile, num_phases };
+
+        Stats& operator+=(const Stats& other);
+
+        size_t files = 0;
+        size_t bytes_read = 0;
+        size_t code_points = 0;
+        TokenCounts tokens = TokenCounts();
+        size_t ast_nodes = 0;
+        size_t arena_bytes = 0; // Reserved by the arenas of the syntax trees.
+        size_t symbols = 0;     // Interned symbols, summed over the interners of all files.
+        size_t allocations[num_phases] = {};
+    };
+
+    // Number of heap allocations made by the calling thread so far. Every operator new counts.
+    size_t allocation_count();
+
+    // While alive, counts the heap allocations made on the calling thread into counter instead
+    // of the counter of an enclosing scope, or nowhere if counter is null. Jobs submitted to a
+    // ThreadPool meanwhile count into counter too, wherever they run, so everything done for one
+    // file is counted together even when other threads help out or the thread helps others.
+    class AllocationScope {
+    public:
+        explicit AllocationScope(std::atomic<size_t>* counter);
+        AllocationScope(const AllocationScope&) = delete;
+        AllocationScope& operator=(const AllocationScope&) = delete;
+        ~AllocationScope();
+
+    private:
+        std::atomic<size_t>* previous;
+    };
+
+    // The counter of the innermost AllocationScope on the calling thread, if any.
+    std::atomic<size_t>* allocation_counter();
+
+    // Peak resident set size of the process in bytes, or 0 if unknown.
+    size_t peak_rss();
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "decode.h"
+#include "exception.h"
+#include "source.h"
+#include "stream.h"
+
+
+namespace p {
+    StreamLexer::StreamLexer(const char* filename, SymbolTable& symbols,
+                             Diagnostics& diagnostics, size_t buffer_size)
+    : fd(open_source(filename)), symbols(symbols), diagnostics(diagnostics),
+      num_adjusted(diagnostics.size()), window(new uint8_t[buffer_size]), capacity(buffer_size),
+      filled(0), limit(0), base(0), base_line(1), total_read(0), total_code_points(0),
+      input_done(false), failed(false),
+      lexer(new Lexer(window.get(), window.get(), symbols, diagnostics)) { }
+
+    StreamLexer::~StreamLexer() {
+        if (fd != STDIN_FILENO) close(fd);
+    }
+
+
+    Token StreamLexer::next() {
+        while (true) {
+            Token tok = lexer->consume();
+            for (; num_adjusted < diagnostics.size(); ++num_adjusted) {
+                diagnostics[num_adjusted].offset += base;
+            }
+
+            // The lexer skips to the newline after an error, so the line of an error is always
+            // still in the window when its newline token is returned.
+            tok.offset += base;
+            if (tok.type != Token::Type::eof || (input_done && limit == filled) || failed) {
+                return tok;
+            }
+
+            refill();
+        }
+    }
+
+
+    // Returns the end of the last complete line in [data, data + size), or 0 if there is none.
+    // A \r at the very end might be the start of a \r\n, so it doesn't count yet.
+    static size_t complete_lines(const uint8_t* data, size_t size) {
+        size_t i = size;
+        if (i && data[i - 1] == '\r') --i;
+        while (i && data[i - 1] != '\n' && data[i - 1] != '\r') --i;
+        return i;
+    }
+
+
+    void StreamLexer::refill() {
+        // Drop the lines that have been lexed, and move the partial line after them to the front.
+        const uint8_t* lexed_end = window.get() + limit;
+        for (const uint8_t* it = window.get(); it != lexed_end; ++base_line) {
+            it = static_cast<const uint8_t*>(std::memchr(it, '\n', lexed_end - it));
+            if (!it) break;
+            ++it;
+        }
+
+        std::memmove(window.get(), window.get() + limit, filled - limit);
+        base += limit;
+        filled -= limit;
+        limit = 0;
+
+        // Read until we have at least one complete line, or the input ends.
+        while (true) {
+            limit = input_done ? filled : complete_lines(window.get(), filled);
+            if (limit || input_done) break;
+
+            // The window holds part of a single line, maybe followed by a \r that isn't a line
+            // break yet. The error goes before that, on the line the window starts at.
+            if (filled == capacity) {
+                size_t line_end = window[filled - 1] == '\r' ? filled - 1 : filled;
+                return fail(Diagnostic::syntax, "Line does not fit in the streaming buffer.",
+                            line_end);
+            }
+
+            ssize_t count = read(fd, window.get() + filled, capacity - filled);
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                throw FilesystemError(std::strerror(errno));
+            }
+
+            if (!count) input_done = true;
+            filled += count;
+            total_read += count;
+        }
+
+        // Complete lines end at a newline, which can't be part of a multi-byte sequence, so they
+        // can be checked on their own.
+        uint8_t* data = window.get();
+        Utf8Scan scan = scan_utf8(data, limit);
+        if (scan.error) {
+            // The lines before the one with the error are lexed first, the error is reported once
+            // the window starts at its line.
+            size_t line_start = scan.error_offset;
+            while (line_start && data[line_start - 1] != '\n' && data[line_start - 1] != '\r') {
+                --line_start;
+            }
+
+            if (!line_start) return fail(Diagnostic::encoding, scan.error, scan.error_offset);
+            limit = line_start;
+            scan = scan_utf8(data, limit);
+        }
+
+        if (scan.has_cr) {
+            // Normalizing only ever shrinks the lines, so it can be done in place.
+            size_t out = 0;
+            for (size_t i = 0; i < limit; ++i) {
+                if (data[i] == '\r') {
+                    data[out++] = '\n';
+                    if (i + 1 < limit && data[i + 1] == '\n') ++i;
+                } else data[out++] = data[i];
+            }
+
+            std::memmove(data + out, data + limit, filled - limit);
+            filled -= limit - out;
+            limit = out;
+        }
+
+        total_code_points += count_code_points(data, limit);
+        lexer.reset(new Lexer(data, data + limit, symbols, diagnostics));
+    }
+
+    // Records an error at offset in the window that keeps the input from being lexed any
+    // further, and ends the input there.
+    void StreamLexer::fail(Diagnostic::Kind kind, const char* message, size_t offset) {
+        diagnostics.error(kind, message, base + offset);
+        num_adjusted = diagnostics.size();
+
+        failed = true;
+        lexer.reset(new Lexer(window.get(), window.get(), symbols, diagnostics));
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef P_STREAM_H
+#define P_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "common.h"
+#include "diagnostic.h"
+#include "intern.h"
+#include "lexer.h"
+
+
+namespace p {
+    // Lexes a file, pipe or stdin in bounded memory, producing tokens as soon as their line has
+    // been read. Input is read in chunks into a fixed-size window, of which only complete lines
+    // are handed to the Lexer. String literals and comments can't contain newlines, so a newline
+    // always ends a token and lexing can pick up after it with a fresh Lexer.
+    //
+    // Token and error offsets are relative to the start of the (newline-normalized) input. Errors
+    // are recorded in diagnostics while their line is still in the window. A single line must
+    // fit in the window, and the input must be valid UTF-8, otherwise the input ends with an
+    // error after the lines before the one that doesn't.
+    class StreamLexer {
+    public:
+        StreamLexer(const char* filename, SymbolTable& symbols, Diagnostics& diagnostics,
+                    size_t buffer_size = 1 << 20);
+        StreamLexer(const StreamLexer&) = delete;
+        StreamLexer& operator=(const StreamLexer&) = delete;
+        ~StreamLexer();
+
+        // Returns the next token, an eof token at the end of the input. Errors found lexing it
+        // are in the window until the next call.
+        Token next();
+
+        // The source text of a token. Only valid for the last token returned by next.
+        u8str text(const Token& tok) const {
+            return u8str(window.get() + (tok.offset - base), tok.length);
+        }
+
+        // The part of the input currently in memory, used to report errors. Offsets in the
+        // window start at window_offset, which is at the start of line window_line.
+        const uint8_t* window_data() const { return window.get(); }
+        size_t window_size() const { return filled; }
+        size_t window_offset() const { return base; }
+        size_t window_line() const { return base_line; }
+
+        // Bytes read from the input so far, and code points in the lines lexed so far.
+        size_t bytes_read() const { return total_read; }
+        size_t code_points() const { return total_code_points; }
+
+    private:
+        void refill();
+        void fail(Diagnostic::Kind kind, const char* message, size_t offset);
+
+        int fd;
+        SymbolTable& symbols;
+        Diagnostics& diagnostics;
+        size_t num_adjusted; // Diagnostics whose offset has been made relative to the input.
+        std::unique_ptr<uint8_t[]> window;
+        size_t capacity;
+        size_t filled;    // Bytes of input in the window.
+        size_t limit;     // End of the complete lines in the window, which are normalized.
+        size_t base;      // Offset of the window in the input.
+        size_t base_line; // Line of the input the window starts at.
+        size_t total_read;
+        size_t total_code_points;
+        bool input_done;
+        bool failed;      // Whether the input ended early because of an error.
+        std::unique_ptr<Lexer> lexer;
+    };
+}
+
+#endif
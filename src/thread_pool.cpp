@@ -0,0 +1,125 @@
+#include "stats.h"
+#include "thread_pool.h"
+
+
+namespace p {
+    // The pool and worker index of the calling thread, if it is a worker.
+    static thread_local ThreadPool* current_pool = nullptr;
+    static thread_local size_t current_worker = 0;
+
+
+    ThreadPool::ThreadPool(size_t num_threads)
+    : queued(0), unfinished(0), next_queue(0), stopping(false) {
+        if (!num_threads) num_threads = std::thread::hardware_concurrency();
+        if (!num_threads) num_threads = 1;
+
+        for (size_t i = 0; i < num_threads; ++i) workers.emplace_back(new Worker);
+        for (size_t i = 0; i < num_threads; ++i) threads.emplace_back(&ThreadPool::run, this, i);
+    }
+
+    ThreadPool::~ThreadPool() {
+        wait();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        work_available.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+
+
+    void ThreadPool::submit(std::function<void()> job) {
+        size_t index = current_pool == this ? current_worker
+                                            : next_queue++ % workers.size();
+
+        ++unfinished;
+
+        // Counting the job under the lock makes sure a worker going to sleep sees it. It's
+        // counted before it's queued so the count never drops below the number of queued jobs.
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++queued;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(workers[index]->mutex);
+            workers[index]->jobs.push_back(Job{std::move(job), allocation_counter()});
+        }
+
+        work_available.notify_one();
+    }
+
+    void ThreadPool::wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        all_done.wait(lock, [this] { return unfinished == 0; });
+    }
+
+
+    void ThreadPool::run_until(const std::function<bool()>& done) {
+        size_t index = current_pool == this ? current_worker : 0;
+
+        Job job;
+        while (!done()) {
+            if (pop(index, job)) execute(job);
+            else std::this_thread::yield();
+        }
+    }
+
+
+    bool ThreadPool::pop(size_t index, Job& job) {
+        {
+            Worker& own = *workers[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.jobs.size()) {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < workers.size(); ++i) {
+            Worker& victim = *workers[(index + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.jobs.size()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void ThreadPool::execute(Job& job) {
+        --queued;
+        {
+            AllocationScope scope(job.allocations);
+            job.run();
+            job.run = nullptr;
+        }
+
+        if (--unfinished == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            all_done.notify_all();
+        }
+    }
+
+    void ThreadPool::run(size_t index) {
+        current_pool = this;
+        current_worker = index;
+
+        Job job;
+        while (true) {
+            if (pop(index, job)) {
+                execute(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            work_available.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping) return;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef P_THREAD_POOL_H
+#define P_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace p {
+    // Fixed-size pool of worker threads with a job queue per worker. Workers run their own jobs
+    // newest first and steal the oldest jobs of other workers when they run out, so jobs that
+    // submit more jobs keep their data warm while idle workers still find work.
+    class ThreadPool {
+    public:
+        // Zero threads means one per core.
+        explicit ThreadPool(size_t num_threads = 0);
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool();
+
+        // Queues a job, on the queue of the calling worker if called from a job. Jobs must not
+        // throw. They count their allocations where the calling thread does (see stats.h).
+        void submit(std::function<void()> job);
+
+        // Blocks until every submitted job has finished.
+        void wait();
+
+        // Runs queued jobs on the calling thread until done returns true. This lets a job wait for
+        // jobs it submitted itself without tying up its worker.
+        void run_until(const std::function<bool()>& done);
+
+        size_t size() const { return threads.size(); }
+
+    private:
+        struct Job {
+            std::function<void()> run;
+            std::atomic<size_t>* allocations; // The submitter's, see AllocationScope.
+        };
+
+        struct Worker {
+            std::mutex mutex;
+            std::deque<Job> jobs;
+        };
+
+        void run(size_t index);
+        bool pop(size_t index, Job& job);
+        void execute(Job& job);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+
+        std::mutex mutex;
+        std::condition_variable work_available;
+        std::condition_variable all_done;
+        std::atomic<size_t> queued;   // Jobs sitting in a queue.
+        std::atomic<size_t> unfinished; // Jobs submitted but not finished.
+        std::atomic<size_t> next_queue;
+        bool stopping;
+    };
+}
+
+#endif
@@ -0,0 +1,127 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "exception.h"
+#include "trace.h"
+
+
+namespace p {
+    struct TraceEvent {
+        const char* name;
+        std::string detail;
+        int64_t start;
+        int64_t duration;
+    };
+
+    // Events of a single thread. Only that thread appends to it, so recording takes no lock.
+    struct ThreadTrace {
+        size_t tid;
+        std::vector<TraceEvent> events;
+    };
+
+    static std::atomic<bool> tracing(false);
+    static std::chrono::steady_clock::time_point epoch;
+
+    // Every thread that recorded an event. The traces are owned here rather than by the threads,
+    // so they survive threads of a ThreadPool that has been destroyed.
+    static std::mutex threads_mutex;
+    static std::vector<std::unique_ptr<ThreadTrace>> threads;
+    static thread_local ThreadTrace* current_thread = nullptr;
+
+
+    static int64_t now() {
+        auto elapsed = std::chrono::steady_clock::now() - epoch;
+        return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    }
+
+    static ThreadTrace& thread_trace() {
+        if (!current_thread) {
+            std::lock_guard<std::mutex> lock(threads_mutex);
+            threads.emplace_back(new ThreadTrace{threads.size() + 1, {}});
+            current_thread = threads.back().get();
+        }
+
+        return *current_thread;
+    }
+
+
+    void enable_tracing() {
+        epoch = std::chrono::steady_clock::now();
+        tracing.store(true);
+    }
+
+
+    TraceScope::TraceScope(const char* name, const char* detail)
+    : name(name), detail(detail), start(-1) {
+        if (tracing.load(std::memory_order_relaxed)) start = now();
+    }
+
+    TraceScope::~TraceScope() {
+        if (start < 0) return;
+
+        int64_t duration = now() - start;
+        thread_trace().events.push_back({name, detail ? detail : "", start, duration});
+    }
+
+
+    // Appends str to out as a JSON string literal.
+    static void append_json_string(std::string& out, const std::string& str) {
+        out += '"';
+        for (char c : str) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escape[8];
+                std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                out += escape;
+            } else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+
+    void write_trace(const char* filename) {
+        std::string out = "{\"traceEvents\": [\n";
+
+        bool first = true;
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        for (auto& thread : threads) {
+            for (auto& event : thread->events) {
+                out += first ? "  " : ",\n  ";
+                first = false;
+
+                out += "{\"name\": ";
+                append_json_string(out, event.name);
+                out += ", \"cat\": \"p\", \"ph\": \"X\", \"pid\": 1, \"tid\": ";
+                out += std::to_string(thread->tid);
+                out += ", \"ts\": " + std::to_string(event.start);
+                out += ", \"dur\": " + std::to_string(event.duration);
+                if (!event.detail.empty()) {
+                    out += ", \"args\": {\"detail\": ";
+                    append_json_string(out, event.detail);
+                    out += '}';
+                }
+                out += '}';
+            }
+        }
+
+        out += "\n], \"displayTimeUnit\": \"ms\"}\n";
+
+        FILE* file = std::fopen(filename, "w");
+        if (!file) throw FilesystemError(std::strerror(errno));
+
+        bool ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+        ok &= std::fclose(file) == 0;
+        if (!ok) throw FilesystemError(std::strerror(errno));
+    }
+}
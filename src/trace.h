@@ -0,0 +1,31 @@
+#ifndef P_TRACE_H
+#define P_TRACE_H
+
+#include <cstdint>
+
+
+namespace p {
+    // Starts recording TraceScopes, on every thread.
+    void enable_tracing();
+
+    // Writes the recorded scopes to filename as Chrome trace events, which chrome://tracing and
+    // Perfetto show as a timeline with one lane per thread. Throws FilesystemError.
+    void write_trace(const char* filename);
+
+    // Records the time between its construction and destruction if tracing is enabled, and does
+    // nothing but check a flag otherwise. name and detail (e.g. a filename) must outlive it.
+    class TraceScope {
+    public:
+        explicit TraceScope(const char* name, const char* detail = nullptr);
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+        ~TraceScope();
+
+    private:
+        const char* name;
+        const char* detail;
+        int64_t start; // In microseconds since tracing was enabled, -1 if it is disabled.
+    };
+}
+
+#endif